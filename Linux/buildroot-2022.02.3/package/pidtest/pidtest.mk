@@ -8,8 +8,12 @@ PIDTEST_VERSION = 1.0
 PIDTEST_SITE = ./package/pidtest/src
 PIDTEST_SITE_METHOD = local
 
+ifeq ($(BR2_PACKAGE_PIDTEST_FAST_MATH),y)
+PIDTEST_MAKE_OPTS += FAST_MATH=1
+endif
+
 define PIDTEST_BUILD_CMDS
-	$(MAKE) CC="$(TARGET_CC)" LD="$(TARGET_LD)" -C $(@D)
+	$(MAKE) CC="$(TARGET_CC)" LD="$(TARGET_LD)" $(PIDTEST_MAKE_OPTS) -C $(@D)
 endef
 
 define PIDTEST_INSTALL_TARGET_CMDS
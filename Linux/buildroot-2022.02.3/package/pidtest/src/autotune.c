@@ -0,0 +1,131 @@
+#include <math.h>
+#include <string.h>
+
+#include "control.h"
+#include "autotune.h"
+
+/*
+ * Proportional gain, integral time and derivative time of every rule as multiples of the ultimate
+ * gain and period
+ */
+static const struct {
+	const char* name;
+	double kp;
+	double ti;
+	double td;
+} RULES[AUTOTUNE_RULE_COUNT] = {
+	[AUTOTUNE_ZIEGLER_NICHOLS] = { "zn", 0.6, 0.5, 0.125 },
+	[AUTOTUNE_TYREUS_LUYBEN] = { "tl", 1.0 / 2.2, 2.2, 1.0 / 6.3 },
+	[AUTOTUNE_SOME_OVERSHOOT] = { "some", 0.33, 0.5, 1.0 / 3.0 },
+	[AUTOTUNE_NO_OVERSHOOT] = { "none", 0.2, 0.5, 1.0 / 3.0 }
+};
+
+/*
+ * Look up a tuning rule by the name used on the command line, returns -1 if there is no such rule
+ */
+int autotune_rule_from_name(const char* name) {
+	int i;
+
+	for(i = 0; i < AUTOTUNE_RULE_COUNT; i++) {
+		if(strcmp(name, RULES[i].name) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+const char* autotune_rule_name(enum autotune_rule rule) {
+	return RULES[rule].name;
+}
+
+/*
+ * Start an experiment with the relay demand amplitude and the hysteresis band (in the units of the
+ * measurement)
+ */
+void autotune_init(struct autotune* at, double amplitude, double hysteresis) {
+	memset(at, 0, sizeof(*at));
+	at->state = AUTOTUNE_RUNNING;
+	at->amplitude = amplitude;
+	at->hysteresis = hysteresis;
+	at->output = amplitude;
+	at->last_rise = -1.0;
+}
+
+/*
+ * Step the relay with the measurement and its setpoint over deltat seconds, returns the demand.
+ * Once the experiment is over (state is no longer AUTOTUNE_RUNNING) the demand is 0.
+ */
+double autotune_update(struct autotune* at, double measurement, double setpoint, double deltat) {
+	double error, a;
+
+	if(at->state != AUTOTUNE_RUNNING) {
+		return 0.0;
+	}
+
+	at->t += deltat;
+	if(at->t > AUTOTUNE_TIMEOUT) {
+		at->state = AUTOTUNE_FAILED;
+		return 0.0;
+	}
+
+	if(measurement > at->max) {
+		at->max = measurement;
+	}
+	if(measurement < at->min) {
+		at->min = measurement;
+	}
+
+	error = setpoint - measurement;
+
+	if(at->output > 0.0 && error < -at->hysteresis) {
+		at->output = -at->amplitude;
+	} else if(at->output < 0.0 && error > at->hysteresis) {
+		at->output = at->amplitude;
+
+		/* Every switch back to the positive demand ends an oscillation */
+		if(at->last_rise >= 0.0) {
+			at->cycles++;
+			if(at->cycles > AUTOTUNE_SKIP) {
+				at->period_sum += at->t - at->last_rise;
+				at->amplitude_sum += 0.5 * (at->max - at->min);
+			}
+		}
+
+		at->last_rise = at->t;
+		at->max = measurement;
+		at->min = measurement;
+
+		if(at->cycles >= AUTOTUNE_SKIP + AUTOTUNE_CYCLES) {
+			/* Describing function of a relay with hysteresis */
+			a = at->amplitude_sum / AUTOTUNE_CYCLES;
+			if(a <= at->hysteresis) {
+				at->state = AUTOTUNE_FAILED;
+				return 0.0;
+			}
+
+			at->tu = at->period_sum / AUTOTUNE_CYCLES;
+			at->ku = 4.0 * at->amplitude / (M_PI * sqrt(a * a - at->hysteresis * at->hysteresis));
+			at->state = AUTOTUNE_DONE;
+			return 0.0;
+		}
+	}
+
+	return at->output;
+}
+
+/*
+ * Compute the gains from a finished experiment with the rule, the limits in gains are left as they
+ * are.  Returns -1 if the experiment didn't finish.
+ */
+int autotune_gains(struct autotune* at, enum autotune_rule rule, struct pid_gains* gains) {
+	if(at->state != AUTOTUNE_DONE) {
+		return -1;
+	}
+
+	gains->kp = RULES[rule].kp * at->ku;
+	gains->ki = gains->kp / (RULES[rule].ti * at->tu);
+	gains->kd = gains->kp * RULES[rule].td * at->tu;
+
+	return 0;
+}
@@ -0,0 +1,60 @@
+#include "control.h"
+
+/*
+ * Relay feedback autotuner (Astrom and Hagglund).
+ *
+ * Instead of the PID the axis is driven by a relay: a fixed positive demand while the measurement
+ * is below the setpoint and a fixed negative one while it is above, with a little hysteresis against
+ * noise.  This settles into a limit cycle at the ultimate period of the loop, and the amplitude of
+ * the oscillation gives the ultimate gain.  The PID gains then follow from one of the classic
+ * tuning rules.  The relay is stepped once per control loop so it runs inside the real time loop.
+ */
+
+#ifndef _AUTOTUNE_H
+#define _AUTOTUNE_H
+
+#define AUTOTUNE_CYCLES 4 /* Oscillations averaged into the result */
+
+static const int AUTOTUNE_SKIP = 2;             /* Oscillations left out while the cycle settles */
+static const double AUTOTUNE_AMPLITUDE = 100.0; /* Relay demand, us of pulse width */
+static const double AUTOTUNE_HYSTERESIS = 2.0;  /* Band around the setpoint, deg/s */
+static const double AUTOTUNE_TIMEOUT = 30.0;    /* Seconds before the experiment is given up */
+
+enum autotune_rule {
+	AUTOTUNE_ZIEGLER_NICHOLS,
+	AUTOTUNE_TYREUS_LUYBEN,
+	AUTOTUNE_SOME_OVERSHOOT,
+	AUTOTUNE_NO_OVERSHOOT,
+	AUTOTUNE_RULE_COUNT
+};
+
+enum autotune_state {
+	AUTOTUNE_RUNNING,
+	AUTOTUNE_DONE,
+	AUTOTUNE_FAILED
+};
+
+struct autotune {
+	enum autotune_state state;
+	double amplitude;
+	double hysteresis;
+	double output;       /* Current relay demand */
+	double t;            /* Time since the start */
+	double last_rise;    /* Time of the last switch to the positive demand, negative before the first */
+	double max;          /* Extremes of the measurement in the current oscillation */
+	double min;
+	int cycles;          /* Complete oscillations so far */
+	double period_sum;
+	double amplitude_sum;
+	double ku;           /* Ultimate gain */
+	double tu;           /* Ultimate period in seconds */
+};
+
+int autotune_rule_from_name(const char*);
+const char* autotune_rule_name(enum autotune_rule);
+
+void autotune_init(struct autotune*, double, double);
+double autotune_update(struct autotune*, double, double, double);
+int autotune_gains(struct autotune*, enum autotune_rule, struct pid_gains*);
+
+#endif
@@ -0,0 +1,182 @@
+#include <string.h>
+
+#include "gyro.h"
+#include "quaternion.h"
+#include "filter.h"
+#include "control.h"
+
+static const char* AXIS_NAMES[CONTROL_AXES] = {
+	[AXIS_ROLL] = "roll",
+	[AXIS_PITCH] = "pitch",
+	[AXIS_YAW] = "yaw"
+};
+
+int control_axis_from_name(const char* name) {
+	int i;
+
+	for(i = 0; i < CONTROL_AXES; i++) {
+		if(strcmp(name, AXIS_NAMES[i]) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+const char* control_axis_name(enum control_axis axis) {
+	return AXIS_NAMES[axis];
+}
+
+/*
+ * Set the gains of one axis and clear its state
+ */
+void pid_init(struct pid_axis* pid, struct pid_gains gains) {
+	pid->gains = gains;
+	pid_reset(pid);
+}
+
+/*
+ * Forget the integral and the previous error, e.g. when the motors are disarmed
+ */
+void pid_reset(struct pid_axis* pid) {
+	pid->integral = 0.0;
+	pid->prev_input = 0.0;
+	pid->prev_setpoint = 0.0;
+	pid->primed = 0;
+}
+
+/*
+ * Bound x to [-limit, limit]
+ */
+static double clamp(double x, double limit) {
+	if(x > limit) {
+		return limit;
+	}
+	if(x < -limit) {
+		return -limit;
+	}
+	return x;
+}
+
+/*
+ * Run one step of the PID towards setpoint from measurement over deltat seconds, with the
+ * derivative and the feed-forward smoothed by the given axis of dterm and ff if they aren't NULL.
+ *
+ * The integral is bounded by i_limit and is also held while the output is saturated in the
+ * direction the error is pushing it, so it can't wind up while the actuator is at its limit.
+ */
+static double pid_step(struct pid_axis* pid, double setpoint, double measurement, double deltat, struct pt1_filter* dterm, struct pt1_filter* ff, int axis) {
+	double error, input, p, i, d, f, out;
+
+	error = setpoint - measurement;
+	input = pid->gains.dterm_weight * setpoint - measurement;
+
+	p = pid->gains.kp * (pid->gains.setpoint_weight * setpoint - measurement);
+
+	d = 0.0;
+	f = 0.0;
+	if(pid->primed && deltat > 0.0) {
+		d = pid->gains.kd * (input - pid->prev_input) / deltat;
+		f = pid->gains.kf * (setpoint - pid->prev_setpoint) / deltat;
+	}
+	if(dterm != NULL) {
+		d = pt1_apply_axis(dterm, axis, d);
+	}
+	if(ff != NULL) {
+		f = pt1_apply_axis(ff, axis, f);
+	}
+
+	i = pid->integral;
+	if(deltat > 0.0) {
+		i = clamp(i + pid->gains.ki * error * deltat, pid->gains.i_limit);
+	}
+
+	out = p + i + d + f;
+	if((out > pid->gains.out_limit && error > 0.0) || (out < -pid->gains.out_limit && error < 0.0)) {
+		out = p + pid->integral + d + f;
+	} else {
+		pid->integral = i;
+	}
+
+	pid->prev_input = input;
+	pid->prev_setpoint = setpoint;
+	pid->primed = 1;
+
+	return clamp(out, pid->gains.out_limit);
+}
+
+/*
+ * One step on an error alone, the setpoint weights and the feed-forward act on the whole error
+ */
+double pid_update(struct pid_axis* pid, double error, double deltat) {
+	return pid_step(pid, error, 0.0, deltat, NULL, NULL, 0);
+}
+
+/*
+ * Set up both loops with the same gains on every axis, the derivative filter is designed for the
+ * nominal rate of the loop in Hz
+ */
+void controller_init(struct controller* c, struct pid_gains angle, struct pid_gains rate, double loop_rate) {
+	int i;
+
+	for(i = 0; i < CONTROL_AXES; i++) {
+		pid_init(&c->angle[i], angle);
+		pid_init(&c->rate[i], rate);
+	}
+
+	pt1_init(&c->dterm, DTERM_LPF_HZ, loop_rate);
+	pt1_init(&c->feedforward, FEEDFORWARD_LPF_HZ, loop_rate);
+	memset(&c->rate_setpoint, 0, sizeof(c->rate_setpoint));
+}
+
+/*
+ * Give one axis of the rate loop its own gains, the state of the axis is kept
+ */
+void controller_set_rate_gains(struct controller* c, enum control_axis axis, struct pid_gains gains) {
+	c->rate[axis].gains = gains;
+}
+
+/*
+ * Clear the state of every loop and axis but keep the gains
+ */
+void controller_reset(struct controller* c) {
+	int i;
+
+	for(i = 0; i < CONTROL_AXES; i++) {
+		pid_reset(&c->angle[i]);
+		pid_reset(&c->rate[i]);
+	}
+
+	memset(c->dterm.state, 0, sizeof(c->dterm.state));
+	memset(c->feedforward.state, 0, sizeof(c->feedforward.state));
+	memset(&c->rate_setpoint, 0, sizeof(c->rate_setpoint));
+}
+
+/*
+ * Outer loop: compute the rate setpoint that turns the attitude q towards target
+ */
+struct vec3 controller_update_angle(struct controller* c, struct quaternion q, struct quaternion target, double deltat) {
+	struct vec3 err;
+
+	/* quat_error() is how far q is past the target, the rate has to go the other way */
+	err = quat_error(q, target);
+
+	c->rate_setpoint.x = pid_update(&c->angle[AXIS_ROLL], -err.x, deltat);
+	c->rate_setpoint.y = pid_update(&c->angle[AXIS_PITCH], -err.y, deltat);
+	c->rate_setpoint.z = pid_update(&c->angle[AXIS_YAW], -err.z, deltat);
+
+	return c->rate_setpoint;
+}
+
+/*
+ * Inner loop: compute the demand on every axis from the measured body rates w (degrees per second)
+ */
+struct vec3 controller_update_rate(struct controller* c, struct vec3 w, double deltat) {
+	struct vec3 out;
+
+	out.x = pid_step(&c->rate[AXIS_ROLL], c->rate_setpoint.x, w.x, deltat, &c->dterm, &c->feedforward, AXIS_ROLL);
+	out.y = pid_step(&c->rate[AXIS_PITCH], c->rate_setpoint.y, w.y, deltat, &c->dterm, &c->feedforward, AXIS_PITCH);
+	out.z = pid_step(&c->rate[AXIS_YAW], c->rate_setpoint.z, w.z, deltat, &c->dterm, &c->feedforward, AXIS_YAW);
+
+	return out;
+}
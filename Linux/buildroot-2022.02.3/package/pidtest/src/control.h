@@ -0,0 +1,81 @@
+#include "gyro.h"
+#include "quaternion.h"
+#include "filter.h"
+
+/*
+ * Cascaded attitude controller.
+ *
+ * The outer loop turns the attitude error into a body rate setpoint and the inner loop turns the
+ * rate error, measured directly with the gyroscope, into a demand for each axis.  The inner loop can
+ * run at the full gyroscope rate while the outer loop follows the (slower) estimator.  Every axis
+ * of every loop keeps its own state so nothing is shared between calls through statics.
+ *
+ * Angles are in degrees, rates in degrees per second and the integral and derivative terms are
+ * scaled with the measured loop time so the gains don't change with the loop rate.  A positive
+ * demand is a positive torque around the body axis, the mixer maps it to the motors.
+ */
+
+#ifndef _CONTROL_H
+#define _CONTROL_H
+
+#define CONTROL_AXES 3
+
+enum control_axis {
+	AXIS_ROLL,
+	AXIS_PITCH,
+	AXIS_YAW
+};
+
+static const double CONTROL_ANGLE_KP = 4.0;      /* Rate setpoint per degree of attitude error, 1/s */
+static const double CONTROL_MAX_RATE = 200.0;    /* Largest rate the angle loop will ask for, deg/s */
+static const double CONTROL_OUTPUT_LIMIT = 1000.0; /* Largest demand of the rate loop, us of pulse width */
+static const double CONTROL_I_LIMIT = 300.0;     /* Largest integral contribution, us of pulse width */
+
+/*
+ * The proportional term acts on setpoint_weight * setpoint - measurement and the derivative on
+ * dterm_weight * setpoint - measurement, so a weight of 1 is the classic PID on the error and a
+ * derivative weight of 0 takes the derivative of the measurement only, which doesn't kick when the
+ * setpoint jumps.  The integral always acts on the whole error so there is no steady state error.
+ * The feed-forward term is kf times the (smoothed) rate of change of the setpoint.
+ */
+struct pid_gains {
+	double kp;
+	double ki;        /* Per second */
+	double kd;        /* Seconds */
+	double kf;        /* Seconds */
+	double setpoint_weight;
+	double dterm_weight;
+	double i_limit;   /* Bound on the integral term */
+	double out_limit; /* Bound on the output */
+};
+
+struct pid_axis {
+	struct pid_gains gains;
+	double integral;   /* Integral term, already multiplied by ki */
+	double prev_input; /* Last input of the derivative */
+	double prev_setpoint;
+	int primed;        /* The previous values hold a real sample, the derivatives are skipped until then */
+};
+
+struct controller {
+	struct pid_axis angle[CONTROL_AXES]; /* Outer loop, degrees to degrees per second */
+	struct pid_axis rate[CONTROL_AXES];  /* Inner loop, degrees per second to output */
+	struct vec3 rate_setpoint;           /* Last output of the angle loop */
+	struct pt1_filter dterm;             /* Low pass on the derivative of the rate loop */
+	struct pt1_filter feedforward;       /* Low pass on the feed-forward of the rate loop */
+};
+
+int control_axis_from_name(const char*);
+const char* control_axis_name(enum control_axis);
+
+void pid_init(struct pid_axis*, struct pid_gains);
+void pid_reset(struct pid_axis*);
+double pid_update(struct pid_axis*, double, double);
+
+void controller_init(struct controller*, struct pid_gains, struct pid_gains, double);
+void controller_set_rate_gains(struct controller*, enum control_axis, struct pid_gains);
+void controller_reset(struct controller*);
+struct vec3 controller_update_angle(struct controller*, struct quaternion, struct quaternion, double);
+struct vec3 controller_update_rate(struct controller*, struct vec3, double);
+
+#endif
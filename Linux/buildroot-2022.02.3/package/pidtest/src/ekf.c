@@ -0,0 +1,249 @@
+#include <math.h>
+#include <string.h>
+
+#include "gyro.h"
+#include "quaternion.h"
+#include "ekf.h"
+
+static const double EKF_ACCEL_GATE = 0.3; /* Skip the accelerometer when |a| is this far from 1 g */
+
+/*
+ * Reset the filter to the identity attitude with no bias
+ */
+void ekf_init(struct ekf_filter* f) {
+	f->q = QUAT_IDENTITY;
+	memset(&f->bias, 0, sizeof(f->bias));
+	memset(&f->w, 0, sizeof(f->w));
+	ekf_reset_covariance(f);
+}
+
+/*
+ * Go back to the initial uncertainty, e.g. after the attitude has been set from outside the filter
+ */
+void ekf_reset_covariance(struct ekf_filter* f) {
+	int i;
+
+	memset(f->paa, 0, sizeof(f->paa));
+	memset(f->pab, 0, sizeof(f->pab));
+	memset(f->pbb, 0, sizeof(f->pbb));
+
+	for(i = 0; i < 3; i++) {
+		f->paa[i][i] = EKF_INITIAL_ATTITUDE * EKF_INITIAL_ATTITUDE;
+		f->pbb[i][i] = EKF_INITIAL_BIAS * EKF_INITIAL_BIAS;
+	}
+}
+
+/*
+ * Propagate the error covariance P = F P F' + Q over deltat with the body rate w (rad/s).
+ *
+ * The transition matrix is [ T, -dt I ; 0, I ] with T = I - dt [w x], so the blocks are updated
+ * directly instead of multiplying full 6x6 matrices.
+ */
+static void ekf_propagate_covariance(struct ekf_filter* f, struct vec3 w, double deltat) {
+	double t[3][3], tp[3][3], x[3][3], aa[3][3];
+	double qa, qb;
+	int i, j, k;
+
+	t[0][0] = 1.0;            t[0][1] = deltat * w.z;   t[0][2] = -deltat * w.y;
+	t[1][0] = -deltat * w.z;  t[1][1] = 1.0;            t[1][2] = deltat * w.x;
+	t[2][0] = deltat * w.y;   t[2][1] = -deltat * w.x;  t[2][2] = 1.0;
+
+	/* tp = T Paa, x = T Pab */
+	for(i = 0; i < 3; i++) {
+		for(j = 0; j < 3; j++) {
+			tp[i][j] = 0.0;
+			x[i][j] = 0.0;
+			for(k = 0; k < 3; k++) {
+				tp[i][j] += t[i][k] * f->paa[k][j];
+				x[i][j] += t[i][k] * f->pab[k][j];
+			}
+		}
+	}
+
+	/* Paa = T Paa T' - dt (X + X') + dt^2 Pbb, only the upper triangle is computed */
+	for(i = 0; i < 3; i++) {
+		for(j = i; j < 3; j++) {
+			aa[i][j] = 0.0;
+			for(k = 0; k < 3; k++) {
+				aa[i][j] += tp[i][k] * t[j][k];
+			}
+			aa[i][j] += -deltat * (x[i][j] + x[j][i]) + deltat * deltat * f->pbb[i][j];
+			aa[j][i] = aa[i][j];
+		}
+	}
+
+	/* Pab = X - dt Pbb */
+	for(i = 0; i < 3; i++) {
+		for(j = 0; j < 3; j++) {
+			f->paa[i][j] = aa[i][j];
+			f->pab[i][j] = x[i][j] - deltat * f->pbb[i][j];
+		}
+	}
+
+	/* Process noise, Pbb only changes through it */
+	qa = EKF_GYRO_NOISE * EKF_GYRO_NOISE * deltat;
+	qb = EKF_BIAS_NOISE * EKF_BIAS_NOISE * deltat;
+	for(i = 0; i < 3; i++) {
+		f->paa[i][i] += qa;
+		f->pbb[i][i] += qb;
+	}
+}
+
+/*
+ * Fuse one scalar measurement with Jacobian [h, 0] (only the attitude error is observed),
+ * innovation y and noise variance r into the error state dx.
+ */
+static void ekf_scalar_update(struct ekf_filter* f, const double h[3], double y, double r, double dx[EKF_STATES]) {
+	double pha[3], phb[3], ka[3], kb[3];
+	double s;
+	int i, j;
+
+	/* P H' */
+	for(i = 0; i < 3; i++) {
+		pha[i] = f->paa[i][0] * h[0] + f->paa[i][1] * h[1] + f->paa[i][2] * h[2];
+		phb[i] = f->pab[0][i] * h[0] + f->pab[1][i] * h[1] + f->pab[2][i] * h[2];
+	}
+
+	s = h[0] * pha[0] + h[1] * pha[1] + h[2] * pha[2] + r;
+	s = 1.0 / s;
+
+	/* Innovation against what the earlier updates in this step already explained */
+	y -= h[0] * dx[0] + h[1] * dx[1] + h[2] * dx[2];
+
+	for(i = 0; i < 3; i++) {
+		ka[i] = pha[i] * s;
+		kb[i] = phb[i] * s;
+		dx[i] += ka[i] * y;
+		dx[i + 3] += kb[i] * y;
+	}
+
+	/* P = P - K H P */
+	for(i = 0; i < 3; i++) {
+		for(j = 0; j < 3; j++) {
+			f->paa[i][j] -= ka[i] * pha[j];
+			f->pab[i][j] -= ka[i] * phb[j];
+			f->pbb[i][j] -= kb[i] * phb[j];
+		}
+	}
+}
+
+/*
+ * Fuse a normalised vector measurement z against the prediction p with noise variance r.  The
+ * rows of the Jacobian are the rows of the cross product matrix [p x].
+ */
+static void ekf_vector_update(struct ekf_filter* f, struct vec3 z, struct vec3 p, double r, double dx[EKF_STATES]) {
+	double h[3];
+
+	h[0] = 0.0;   h[1] = -p.z;  h[2] = p.y;
+	ekf_scalar_update(f, h, z.x - p.x, r, dx);
+
+	h[0] = p.z;   h[1] = 0.0;   h[2] = -p.x;
+	ekf_scalar_update(f, h, z.y - p.y, r, dx);
+
+	h[0] = -p.y;  h[1] = p.x;   h[2] = 0.0;
+	ekf_scalar_update(f, h, z.z - p.z, r, dx);
+}
+
+/*
+ * Propagate the covariance over deltat and fuse the accelerometer and magnetometer readings
+ */
+void ekf_correct(struct ekf_filter* f, struct vec3 a, struct vec3 m, double deltat) {
+	struct quaternion q = f->q;
+	struct quaternion dq;
+	struct vec3 v, mb;
+	double dx[EKF_STATES];
+	double norm, hx, hy, hz, bx, bz, tmp;
+	double q1q1 = q.q1 * q.q1;
+	double q1q2 = q.q1 * q.q2;
+	double q1q3 = q.q1 * q.q3;
+	double q1q4 = q.q1 * q.q4;
+	double q2q2 = q.q2 * q.q2;
+	double q2q3 = q.q2 * q.q3;
+	double q2q4 = q.q2 * q.q4;
+	double q3q3 = q.q3 * q.q3;
+	double q3q4 = q.q3 * q.q4;
+	double q4q4 = q.q4 * q.q4;
+	int i, j;
+
+	ekf_propagate_covariance(f, f->w, deltat);
+
+	memset(dx, 0, sizeof(dx));
+
+	/* Accelerometer, skipped when the air craft is accelerating hard */
+	norm = sqrt(a.x * a.x + a.y * a.y + a.z * a.z);
+	if (norm > 0.0 && fabs(norm - 1.0) < EKF_ACCEL_GATE) {
+		norm = 1.0 / norm;
+		a.x *= norm;
+		a.y *= norm;
+		a.z *= norm;
+
+		/* Estimated direction of gravity */
+		v.x = 2.0 * (q2q4 - q1q3);
+		v.y = 2.0 * (q1q2 + q3q4);
+		v.z = q1q1 - q2q2 - q3q3 + q4q4;
+
+		ekf_vector_update(f, a, v, EKF_ACCEL_NOISE * EKF_ACCEL_NOISE, dx);
+	}
+
+	/* Magnetometer */
+	norm = sqrt(m.x * m.x + m.y * m.y + m.z * m.z);
+	if (norm > 0.0) {
+		norm = 1.0 / norm;
+		m.x *= norm;
+		m.y *= norm;
+		m.z *= norm;
+
+		/* Reference direction of Earth's magnetic field */
+		hx = 2.0 * m.x * (0.5 - q3q3 - q4q4) + 2.0 * m.y * (q2q3 - q1q4) + 2.0 * m.z * (q2q4 + q1q3);
+		hy = 2.0 * m.x * (q2q3 + q1q4) + 2.0 * m.y * (0.5 - q2q2 - q4q4) + 2.0 * m.z * (q3q4 - q1q2);
+		hz = 2.0 * m.x * (q2q4 - q1q3) + 2.0 * m.y * (q3q4 + q1q2) + 2.0 * m.z * (0.5 - q2q2 - q3q3);
+		bx = sqrt(hx * hx + hy * hy);
+		bz = hz;
+
+		/* Estimated direction of the magnetic field */
+		mb.x = 2.0 * bx * (0.5 - q3q3 - q4q4) + 2.0 * bz * (q2q4 - q1q3);
+		mb.y = 2.0 * bx * (q2q3 - q1q4) + 2.0 * bz * (q1q2 + q3q4);
+		mb.z = 2.0 * bx * (q1q3 + q2q4) + 2.0 * bz * (0.5 - q2q2 - q3q3);
+
+		ekf_vector_update(f, m, mb, EKF_MAG_NOISE * EKF_MAG_NOISE, dx);
+	}
+
+	/* Move the error into the nominal state, the error state goes back to zero */
+	dq.q1 = 1.0;
+	dq.q2 = 0.5 * dx[0];
+	dq.q3 = 0.5 * dx[1];
+	dq.q4 = 0.5 * dx[2];
+	f->q = quat_normalise(quat_multiply(q, dq));
+
+	f->bias.x += dx[3];
+	f->bias.y += dx[4];
+	f->bias.z += dx[5];
+
+	/* Keep the diagonal blocks symmetric against rounding */
+	for(i = 0; i < 3; i++) {
+		for(j = i + 1; j < 3; j++) {
+			tmp = 0.5 * (f->paa[i][j] + f->paa[j][i]);
+			f->paa[i][j] = tmp;
+			f->paa[j][i] = tmp;
+			tmp = 0.5 * (f->pbb[i][j] + f->pbb[j][i]);
+			f->pbb[i][j] = tmp;
+			f->pbb[j][i] = tmp;
+		}
+	}
+}
+
+/*
+ * Get the attitude quaternion derived from the accelerometer, magnetometer and gyroscope readings
+ */
+struct quaternion ekf_update(struct ekf_filter* f, struct vec3 w, struct vec3 a, struct vec3 m, double deltat) {
+	/* Convert degrees to radians and take the bias out */
+	f->w.x = w.x * 0.017453 - f->bias.x;
+	f->w.y = w.y * 0.017453 - f->bias.y;
+	f->w.z = w.z * 0.017453 - f->bias.z;
+
+	f->q = quat_normalise(quat_integrate(f->q, f->w, deltat));
+
+	ekf_correct(f, a, m, deltat);
+
+	return f->q;
+}
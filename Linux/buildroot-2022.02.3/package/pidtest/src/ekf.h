@@ -0,0 +1,42 @@
+#include "quaternion.h"
+
+/*
+ * Error-state extended Kalman filter for the attitude and the gyroscope bias.
+ *
+ * The nominal attitude is a quaternion propagated with the bias corrected gyroscope rates, the
+ * filter itself only tracks the small error around it: a rotation vector in the body frame and the
+ * error of the bias estimate (6 states).  The accelerometer and magnetometer are fused as six
+ * sequential scalar updates so no matrix ever has to be inverted, and the covariance is stored as
+ * fixed size blocks so nothing is allocated at run time.
+ *
+ * The replay tool measures the time per update (ns/update) next to the other estimators, run it
+ * on the board to see what the filter leaves of the loop period for the controller.
+ */
+
+#ifndef _EKF_H
+#define _EKF_H
+
+#define EKF_STATES 6 /* Attitude error (0-2) and gyroscope bias error (3-5) */
+
+static const double EKF_GYRO_NOISE = 0.001;     /* Gyroscope noise density, rad/s/sqrt(Hz) */
+static const double EKF_BIAS_NOISE = 0.0001;    /* Gyroscope bias random walk, rad/s/sqrt(s) */
+static const double EKF_ACCEL_NOISE = 0.05;     /* Normalised accelerometer noise */
+static const double EKF_MAG_NOISE = 0.1;        /* Normalised magnetometer noise */
+static const double EKF_INITIAL_ATTITUDE = 0.5; /* Initial attitude uncertainty, rad */
+static const double EKF_INITIAL_BIAS = 0.05;    /* Initial bias uncertainty, rad/s */
+
+struct ekf_filter {
+	struct quaternion q;  /* Nominal attitude */
+	struct vec3 bias;     /* Gyroscope bias in rad/s, subtracted from the readings */
+	struct vec3 w;        /* Last bias corrected rate, used to propagate the covariance in ekf_correct() */
+	double paa[3][3];     /* Attitude error covariance */
+	double pab[3][3];     /* Attitude / bias error cross covariance */
+	double pbb[3][3];     /* Bias error covariance */
+};
+
+void ekf_init(struct ekf_filter*);
+void ekf_reset_covariance(struct ekf_filter*);
+struct quaternion ekf_update(struct ekf_filter*, struct vec3, struct vec3, struct vec3, double);
+void ekf_correct(struct ekf_filter*, struct vec3, struct vec3, double);
+
+#endif
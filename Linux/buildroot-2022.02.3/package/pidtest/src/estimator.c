@@ -0,0 +1,437 @@
+#include <math.h>
+#include <string.h>
+
+#include "gyro.h"
+#include "quaternion.h"
+#include "estimator.h"
+
+static const char* ESTIMATOR_NAMES[ESTIMATOR_COUNT] = {
+	"madgwick",
+	"mahony",
+	"ekf",
+};
+
+static struct quaternion estimator_state(struct estimator*, struct vec3*);
+static void estimator_correct(struct estimator*, struct quaternion, struct vec3, struct vec3, double);
+static void estimator_decay_boost(struct estimator*, double);
+
+/*
+ * Look up an estimator by name, returns -1 if there is no estimator with that name
+ */
+int estimator_from_name(const char* name) {
+	int i;
+
+	for(i = 0; i < ESTIMATOR_COUNT; i++) {
+		if(strcmp(name, ESTIMATOR_NAMES[i]) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+const char* estimator_name(enum estimator_type type) {
+	return ESTIMATOR_NAMES[type];
+}
+
+/*
+ * Reset an estimator of the given type to the identity attitude
+ */
+void estimator_init(struct estimator* est, enum estimator_type type) {
+	est->type = type;
+	est->batch_t = -1.0;
+	est->boost = 1.0;
+
+	memset(&est->accel_sum, 0, sizeof(est->accel_sum));
+	memset(&est->mag_sum, 0, sizeof(est->mag_sum));
+	memset(&est->mag, 0, sizeof(est->mag));
+	est->accel_count = 0;
+	est->mag_count = 0;
+	est->span = 0.0;
+
+	switch(type) {
+	case ESTIMATOR_MAHONY:
+		mahony_init(&est->mahony);
+		break;
+	case ESTIMATOR_EKF:
+		ekf_init(&est->ekf);
+		break;
+	case ESTIMATOR_MADGWICK:
+	default:
+		est->type = ESTIMATOR_MADGWICK;
+		madgwick_init(&est->madgwick);
+		break;
+	}
+}
+
+/*
+ * Get the attitude quaternion derived from the accelerometer, magnetometer and gyroscope readings
+ */
+struct quaternion get_attitude(struct estimator* est, struct vec3 w, struct vec3 a, struct vec3 m, double deltat) {
+	if(est->boost != 1.0) {
+		estimator_decay_boost(est, deltat);
+	}
+
+	switch(est->type) {
+	case ESTIMATOR_MAHONY:
+		return mahony_update(&est->mahony, w, a, m, deltat);
+	case ESTIMATOR_EKF:
+		return ekf_update(&est->ekf, w, a, m, deltat);
+	case ESTIMATOR_MADGWICK:
+	default:
+		return madgwick_update(&est->madgwick, w, a, m, deltat);
+	}
+}
+
+/*
+ * Get the current attitude and the gyroscope bias correction (radians per second) of an estimator
+ */
+static struct quaternion estimator_state(struct estimator* est, struct vec3* bias) {
+	switch(est->type) {
+	case ESTIMATOR_MAHONY:
+		*bias = mahony_bias(&est->mahony);
+		return est->mahony.q;
+	case ESTIMATOR_EKF:
+		bias->x = -est->ekf.bias.x;
+		bias->y = -est->ekf.bias.y;
+		bias->z = -est->ekf.bias.z;
+		return est->ekf.q;
+	case ESTIMATOR_MADGWICK:
+	default:
+		bias->x = 0.0;
+		bias->y = 0.0;
+		bias->z = 0.0;
+		return est->madgwick.q;
+	}
+}
+
+/*
+ * Store a propagated attitude and apply the accelerometer and magnetometer correction to it
+ */
+static void estimator_correct(struct estimator* est, struct quaternion q, struct vec3 a, struct vec3 m, double deltat) {
+	switch(est->type) {
+	case ESTIMATOR_MAHONY:
+		est->mahony.q = q;
+		mahony_correct(&est->mahony, a, m, deltat);
+		break;
+	case ESTIMATOR_EKF:
+		est->ekf.q = q;
+		ekf_correct(&est->ekf, a, m, deltat);
+		break;
+	case ESTIMATOR_MADGWICK:
+	default:
+		est->madgwick.q = q;
+		madgwick_correct(&est->madgwick, a, m, deltat);
+		break;
+	}
+}
+
+/*
+ * Update the attitude with a whole batch of samples at once.
+ *
+ * Every sample's gyroscope reading is integrated in one tight loop, while the accelerometer is
+ * averaged and only fused (together with the latest magnetometer reading m) every stride samples
+ * and at the end of the batch.  A stride of 0 or less corrects once per batch.  The quaternion is
+ * only normalised when it is corrected.
+ */
+struct quaternion get_attitude_batch(struct estimator* est, const struct imu_batch* batch, struct vec3 m, int stride) {
+	struct quaternion q;
+	struct vec3 bias, a, w;
+	double prev_t, dt, span;
+	int i, n;
+
+	const double DEG_TO_RAD = 0.017453;
+
+	if(stride <= 0 || stride > batch->count) {
+		stride = batch->count;
+	}
+
+	q = estimator_state(est, &bias);
+	if(batch->count == 0) {
+		return q;
+	}
+
+	prev_t = est->batch_t < 0.0 ? batch->t[0] : est->batch_t;
+	span = 0.0;
+	a.x = 0.0;
+	a.y = 0.0;
+	a.z = 0.0;
+	n = 0;
+
+	for(i = 0; i < batch->count; i++) {
+		dt = batch->t[i] - prev_t;
+		prev_t = batch->t[i];
+
+		w.x = batch->wx[i] * DEG_TO_RAD + bias.x;
+		w.y = batch->wy[i] * DEG_TO_RAD + bias.y;
+		w.z = batch->wz[i] * DEG_TO_RAD + bias.z;
+
+		q = quat_integrate(q, w, dt);
+		if(est->type == ESTIMATOR_EKF) {
+			est->ekf.w = w; /* Rate for propagating the covariance when correcting */
+		}
+
+		span += dt;
+		a.x += batch->ax[i];
+		a.y += batch->ay[i];
+		a.z += batch->az[i];
+		n++;
+
+		if(n == stride || i == batch->count - 1) {
+			if(est->boost != 1.0) {
+				estimator_decay_boost(est, span);
+			}
+
+			a.x /= n;
+			a.y /= n;
+			a.z /= n;
+			estimator_correct(est, q, a, m, span);
+			q = estimator_state(est, &bias);
+
+			span = 0.0;
+			a.x = 0.0;
+			a.y = 0.0;
+			a.z = 0.0;
+			n = 0;
+		}
+	}
+
+	est->batch_t = prev_t;
+
+	return q;
+}
+
+/*
+ * Let the correction gain boost from estimator_align() decay towards the steady state gain
+ */
+static void estimator_decay_boost(struct estimator* est, double deltat) {
+	double excess;
+
+	excess = (est->boost - 1.0) * (1.0 - deltat / ALIGN_DECAY);
+	if(excess < 0.05) {
+		excess = 0.0; /* Snap back exactly so the check in the update path stops triggering */
+	}
+	est->boost = 1.0 + excess;
+
+	switch(est->type) {
+	case ESTIMATOR_MAHONY:
+		est->mahony.kp = MAHONY_KP * est->boost;
+		break;
+	case ESTIMATOR_EKF:
+		break; /* The covariance already weights the correction, nothing to boost */
+	case ESTIMATOR_MADGWICK:
+	default:
+		est->madgwick.beta = BETA * est->boost;
+		break;
+	}
+}
+
+/*
+ * Start the estimator straight from the attitude given by averaged accelerometer (tilt) and
+ * magnetometer (heading) readings taken at rest, instead of letting it converge from the identity
+ * quaternion.  The correction gain is boosted and then decays back to the steady state value to
+ * mop up the remaining error.
+ */
+void estimator_align(struct estimator* est, struct vec3 a, struct vec3 m) {
+	struct vec3 x, y, z;
+	struct quaternion q;
+	double r[3][3];
+	double norm;
+
+	/* Earth "up" in the sensor frame */
+	norm = sqrt(a.x * a.x + a.y * a.y + a.z * a.z);
+	if(norm == 0.0) {
+		return;
+	}
+	z.x = a.x / norm;
+	z.y = a.y / norm;
+	z.z = a.z / norm;
+
+	/* Earth "north" is the horizontal part of the magnetic field */
+	norm = m.x * z.x + m.y * z.y + m.z * z.z;
+	x.x = m.x - norm * z.x;
+	x.y = m.y - norm * z.y;
+	x.z = m.z - norm * z.z;
+	norm = sqrt(x.x * x.x + x.y * x.y + x.z * x.z);
+	if(norm == 0.0) {
+		return;
+	}
+	x.x /= norm;
+	x.y /= norm;
+	x.z /= norm;
+
+	/* Complete the right handed frame */
+	y.x = z.y * x.z - z.z * x.y;
+	y.y = z.z * x.x - z.x * x.z;
+	y.z = z.x * x.y - z.y * x.x;
+
+	/* The rows of the body to earth rotation are the earth axes seen from the body */
+	r[0][0] = x.x; r[0][1] = x.y; r[0][2] = x.z;
+	r[1][0] = y.x; r[1][1] = y.y; r[1][2] = y.z;
+	r[2][0] = z.x; r[2][1] = z.y; r[2][2] = z.z;
+
+	q = quat_from_matrix(r);
+
+	switch(est->type) {
+	case ESTIMATOR_MAHONY:
+		est->mahony.q = q;
+		break;
+	case ESTIMATOR_EKF:
+		est->ekf.q = q;
+		ekf_reset_covariance(&est->ekf);
+		break;
+	case ESTIMATOR_MADGWICK:
+	default:
+		est->madgwick.q = q;
+		break;
+	}
+
+	est->boost = ALIGN_BOOST;
+	estimator_decay_boost(est, 0.0);
+}
+
+/*
+ * Check if the attitude can be trusted: the gain boost has decayed and the estimated gravity
+ * direction agrees with the accelerometer reading a to within ALIGN_TOLERANCE.
+ */
+int estimator_valid(struct estimator* est, struct vec3 a) {
+	struct quaternion q;
+	struct vec3 bias, v;
+	double norm, cosine;
+
+	if(est->boost != 1.0) {
+		return 0;
+	}
+
+	q = estimator_state(est, &bias);
+
+	/* Estimated direction of gravity */
+	v.x = 2.0 * (q.q2 * q.q4 - q.q1 * q.q3);
+	v.y = 2.0 * (q.q1 * q.q2 + q.q3 * q.q4);
+	v.z = q.q1 * q.q1 - q.q2 * q.q2 - q.q3 * q.q3 + q.q4 * q.q4;
+
+	norm = sqrt(a.x * a.x + a.y * a.y + a.z * a.z);
+	if(norm == 0.0) {
+		return 0;
+	}
+
+	cosine = (v.x * a.x + v.y * a.y + v.z * a.z) / norm;
+
+	return cosine >= cos(ALIGN_TOLERANCE * 0.017453292519943295);
+}
+
+/*
+ * Multi-rate interface: propagate the attitude with only the gyroscope rates w (degrees per second)
+ * over deltat.  This is the cheap step meant to run at the full gyroscope rate, the readings for
+ * the correction are collected with estimator_add_accel() / estimator_add_mag() at their own rates
+ * and fused with estimator_fuse() at a lower rate.  The quaternion is normalised after every step,
+ * fusion can be decimated or skip a rejected reading and the first order steps would drift off the
+ * unit norm in between.
+ */
+struct quaternion estimator_propagate(struct estimator* est, struct vec3 w, double deltat) {
+	struct quaternion q;
+	struct vec3 bias;
+
+	const double DEG_TO_RAD = 0.017453;
+
+	q = estimator_state(est, &bias);
+
+	w.x = w.x * DEG_TO_RAD + bias.x;
+	w.y = w.y * DEG_TO_RAD + bias.y;
+	w.z = w.z * DEG_TO_RAD + bias.z;
+
+	q = quat_normalise(quat_integrate(q, w, deltat));
+	est->span += deltat;
+
+	switch(est->type) {
+	case ESTIMATOR_MAHONY:
+		est->mahony.q = q;
+		break;
+	case ESTIMATOR_EKF:
+		est->ekf.q = q;
+		est->ekf.w = w; /* Rate for propagating the covariance when fusing */
+		break;
+	case ESTIMATOR_MADGWICK:
+	default:
+		est->madgwick.q = q;
+		break;
+	}
+
+	return q;
+}
+
+/*
+ * Gyroscope rates w (degrees per second) with the bias the estimator has learned taken out, the
+ * rates the attitude is really being propagated with
+ */
+struct vec3 estimator_rates(struct estimator* est, struct vec3 w) {
+	struct vec3 bias;
+
+	const double DEG_TO_RAD = 0.017453;
+
+	estimator_state(est, &bias);
+
+	w.x += bias.x / DEG_TO_RAD;
+	w.y += bias.y / DEG_TO_RAD;
+	w.z += bias.z / DEG_TO_RAD;
+
+	return w;
+}
+
+/*
+ * Collect an accelerometer reading for the next fusion step
+ */
+void estimator_add_accel(struct estimator* est, struct vec3 a) {
+	est->accel_sum.x += a.x;
+	est->accel_sum.y += a.y;
+	est->accel_sum.z += a.z;
+	est->accel_count++;
+}
+
+/*
+ * Collect a magnetometer reading for the next fusion step
+ */
+void estimator_add_mag(struct estimator* est, struct vec3 m) {
+	est->mag_sum.x += m.x;
+	est->mag_sum.y += m.y;
+	est->mag_sum.z += m.z;
+	est->mag_count++;
+}
+
+/*
+ * Correct the propagated attitude with the averaged readings collected since the last fusion
+ * step.  Nothing happens until at least one accelerometer and one magnetometer reading arrived.
+ */
+struct quaternion estimator_fuse(struct estimator* est) {
+	struct quaternion q;
+	struct vec3 bias, a;
+
+	q = estimator_state(est, &bias);
+
+	if(est->mag_count > 0) {
+		est->mag.x = est->mag_sum.x / est->mag_count;
+		est->mag.y = est->mag_sum.y / est->mag_count;
+		est->mag.z = est->mag_sum.z / est->mag_count;
+		memset(&est->mag_sum, 0, sizeof(est->mag_sum));
+		est->mag_count = 0;
+	}
+
+	if(est->accel_count == 0 || (est->mag.x == 0.0 && est->mag.y == 0.0 && est->mag.z == 0.0)) {
+		return q;
+	}
+
+	a.x = est->accel_sum.x / est->accel_count;
+	a.y = est->accel_sum.y / est->accel_count;
+	a.z = est->accel_sum.z / est->accel_count;
+	memset(&est->accel_sum, 0, sizeof(est->accel_sum));
+	est->accel_count = 0;
+
+	if(est->boost != 1.0) {
+		estimator_decay_boost(est, est->span);
+	}
+
+	estimator_correct(est, q, a, est->mag, est->span);
+	est->span = 0.0;
+
+	return estimator_state(est, &bias);
+}
@@ -0,0 +1,80 @@
+#include "quaternion.h"
+#include "madgwick.h"
+#include "mahony.h"
+#include "ekf.h"
+
+/*
+ * Common interface over the attitude estimators so that the filter can be picked at startup and
+ * the estimators can be compared against each other in the replay tool.
+ */
+
+#ifndef _ESTIMATOR_H
+#define _ESTIMATOR_H
+
+#define IMU_BATCH_MAX 64 /* Most samples that can be handed to the estimator at once */
+
+static const int ALIGN_SAMPLES = 50;        /* Samples averaged to compute the starting attitude */
+static const double ALIGN_BOOST = 10.0;     /* Gain multiplier right after alignment */
+static const double ALIGN_DECAY = 0.2;      /* Time constant of the gain boost decay in seconds */
+static const double ALIGN_TOLERANCE = 2.0;  /* Tilt error in degrees for the attitude to be valid */
+static const double ALIGN_TIMEOUT = 10.0;   /* Seconds to wait for a valid attitude before giving up */
+
+enum estimator_type {
+	ESTIMATOR_MADGWICK,
+	ESTIMATOR_MAHONY,
+	ESTIMATOR_EKF,
+	ESTIMATOR_COUNT
+};
+
+struct estimator {
+	enum estimator_type type;
+	double batch_t; /* Timestamp of the last batched sample, negative before the first batch */
+	double boost;   /* Multiplier on the steady state correction gain, decays back to 1 */
+
+	/* Readings accumulated between fusion steps by the multi-rate interface */
+	struct vec3 accel_sum;
+	struct vec3 mag_sum;
+	struct vec3 mag;  /* Last averaged magnetometer reading, reused when no new one arrived */
+	int accel_count;
+	int mag_count;
+	double span;      /* Time propagated since the last fusion step */
+	union {
+		struct madgwick_filter madgwick;
+		struct mahony_filter mahony;
+		struct ekf_filter ekf;
+	};
+};
+
+/*
+ * A burst of gyroscope and accelerometer samples (e.g. drained from the sensor FIFO) stored as
+ * structure of arrays so the integration loop walks each array linearly.  Units match gyro.c with
+ * the timestamps in seconds.
+ */
+struct imu_batch {
+	int count;
+	double t[IMU_BATCH_MAX];
+	double wx[IMU_BATCH_MAX];
+	double wy[IMU_BATCH_MAX];
+	double wz[IMU_BATCH_MAX];
+	double ax[IMU_BATCH_MAX];
+	double ay[IMU_BATCH_MAX];
+	double az[IMU_BATCH_MAX];
+};
+
+int estimator_from_name(const char*);
+const char* estimator_name(enum estimator_type);
+
+void estimator_init(struct estimator*, enum estimator_type);
+struct quaternion get_attitude(struct estimator*, struct vec3, struct vec3, struct vec3, double);
+struct quaternion get_attitude_batch(struct estimator*, const struct imu_batch*, struct vec3, int);
+
+struct quaternion estimator_propagate(struct estimator*, struct vec3, double);
+void estimator_add_accel(struct estimator*, struct vec3);
+void estimator_add_mag(struct estimator*, struct vec3);
+struct quaternion estimator_fuse(struct estimator*);
+struct vec3 estimator_rates(struct estimator*, struct vec3);
+
+void estimator_align(struct estimator*, struct vec3, struct vec3);
+int estimator_valid(struct estimator*, struct vec3);
+
+#endif
@@ -0,0 +1,94 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fastmath.h"
+
+/*
+ * Reciprocal square root from the exponent bit trick followed by two Newton-Raphson steps.  The
+ * initial guess is within 3.5% and every step squares the error, so two steps bring it down to the
+ * float rounding noise for any positive normal input.  Zero and negative inputs are not handled, the
+ * callers check the norm first.
+ */
+float fast_rsqrt(float x) {
+	float half, y;
+	uint32_t i;
+
+	half = 0.5f * x;
+	memcpy(&i, &x, sizeof(i));
+	i = 0x5f375a86 - (i >> 1);
+	memcpy(&y, &i, sizeof(y));
+
+	y = y * (1.5f - half * y * y);
+	y = y * (1.5f - half * y * y);
+
+	return y;
+}
+
+/*
+ * Square root as x / sqrt(x), with zero mapped to zero instead of 0 * inf
+ */
+float fast_sqrt(float x) {
+	if(x <= 0.0f) {
+		return 0.0f;
+	}
+
+	return x * fast_rsqrt(x);
+}
+
+/*
+ * Arc tangent on [0, 1], an odd minimax polynomial of degree 11 (Hastings)
+ */
+static double fast_atan_unit(double x) {
+	double x2 = x * x;
+
+	return x * (0.99997726 + x2 * (-0.33262347 + x2 * (0.19354346 + x2 * (-0.11643287 + x2 * (0.05265332 + x2 * -0.01172120)))));
+}
+
+/*
+ * Four quadrant arc tangent.  The argument is folded into the first octant so the polynomial only
+ * has to cover [0, 1], which costs one division.
+ */
+double fast_atan2(double y, double x) {
+	double ax = fabs(x);
+	double ay = fabs(y);
+	double a;
+
+	if(ax == 0.0 && ay == 0.0) {
+		return 0.0;
+	}
+
+	if(ay > ax) {
+		a = M_PI / 2 - fast_atan_unit(ax / ay);
+	} else {
+		a = fast_atan_unit(ay / ax);
+	}
+
+	if(x < 0.0) {
+		a = M_PI - a;
+	}
+	if(y < 0.0) {
+		a = -a;
+	}
+
+	return a;
+}
+
+/*
+ * Arc sine from Abramowitz and Stegun 4.4.46, asin(x) = pi / 2 - sqrt(1 - x) * p(x) on [0, 1].  The
+ * polynomial alone is good to 2e-8, the rest of the error comes from fast_sqrt().  Inputs outside
+ * [-1, 1] are clamped.
+ */
+double fast_asin(double x) {
+	double ax = fabs(x);
+	double p, a;
+
+	if(ax >= 1.0) {
+		return copysign(M_PI / 2, x);
+	}
+
+	p = 1.5707963050 + ax * (-0.2145988016 + ax * (0.0889789874 + ax * (-0.0501743046 + ax * (0.0308918810 + ax * (-0.0170881256 + ax * (0.0066700901 + ax * -0.0012624911))))));
+	a = M_PI / 2 - fast_sqrt(1.0 - ax) * p;
+
+	return copysign(a, x);
+}
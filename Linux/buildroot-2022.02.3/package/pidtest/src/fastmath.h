@@ -0,0 +1,39 @@
+#include <math.h>
+
+/*
+ * Approximations of the transcendental functions used by the estimators.
+ *
+ * On the Pi Zero W the VFP takes tens of cycles for a square root or a division and libm's atan2
+ * and asin are well over a hundred, while the rest of a filter update is mostly multiply-adds.  The
+ * functions here trade a bounded error for speed, the bounds below are checked against libm over the
+ * whole input domain by the mathbench tool.
+ *
+ * The estimators only use them when built with FAST_MATH=1, otherwise the macros at the bottom fall
+ * back to libm.
+ */
+
+#ifndef _FASTMATH_H
+#define _FASTMATH_H
+
+static const double FAST_RSQRT_MAX_ERROR = 5e-6; /* Relative error of fast_rsqrt() and fast_sqrt() */
+static const double FAST_ATAN2_MAX_ERROR = 1e-5; /* Absolute error of fast_atan2() in radians */
+static const double FAST_ASIN_MAX_ERROR = 1e-5;  /* Absolute error of fast_asin() in radians */
+
+float fast_rsqrt(float);
+float fast_sqrt(float);
+double fast_atan2(double, double);
+double fast_asin(double);
+
+#ifdef FAST_MATH
+#define RSQRT(x) fast_rsqrt(x)
+#define SQRT(x) fast_sqrt(x)
+#define ATAN2(y, x) fast_atan2(y, x)
+#define ASIN(x) fast_asin(x)
+#else
+#define RSQRT(x) (1.0 / sqrt(x))
+#define SQRT(x) sqrt(x)
+#define ATAN2(y, x) atan2(y, x)
+#define ASIN(x) asin(x)
+#endif
+
+#endif
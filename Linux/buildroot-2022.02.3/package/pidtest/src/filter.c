@@ -0,0 +1,164 @@
+#include <math.h>
+#include <string.h>
+
+#include "gyro.h"
+#include "filter.h"
+
+/*
+ * Keep a cutoff below the Nyquist frequency of the sample rate
+ */
+static double limit_cutoff(double cutoff, double rate) {
+	if(cutoff > 0.45 * rate) {
+		return 0.45 * rate;
+	}
+
+	return cutoff;
+}
+
+/*
+ * Set up a first order low pass with the cutoff (Hz) at the sample rate (Hz) and clear its state
+ */
+void pt1_init(struct pt1_filter* f, double cutoff, double rate) {
+	pt1_set_cutoff(f, cutoff, rate);
+	memset(f->state, 0, sizeof(f->state));
+}
+
+/*
+ * Change the cutoff without touching the state
+ */
+void pt1_set_cutoff(struct pt1_filter* f, double cutoff, double rate) {
+	double rc, dt;
+
+	rc = 1.0 / (2.0 * M_PI * limit_cutoff(cutoff, rate));
+	dt = 1.0 / rate;
+	f->k = dt / (rc + dt);
+}
+
+double pt1_apply_axis(struct pt1_filter* f, int axis, double x) {
+	f->state[axis] += f->k * (x - f->state[axis]);
+
+	return f->state[axis];
+}
+
+struct vec3 pt1_apply(struct pt1_filter* f, struct vec3 v) {
+	v.x = pt1_apply_axis(f, 0, v.x);
+	v.y = pt1_apply_axis(f, 1, v.y);
+	v.z = pt1_apply_axis(f, 2, v.z);
+
+	return v;
+}
+
+/*
+ * Low pass coefficients from the RBJ audio EQ cookbook
+ */
+void biquad_set_lowpass(struct biquad_filter* f, double cutoff, double rate, double q) {
+	double w0, cs, alpha, a0;
+
+	w0 = 2.0 * M_PI * limit_cutoff(cutoff, rate) / rate;
+	cs = cos(w0);
+	alpha = sin(w0) / (2.0 * q);
+	a0 = 1.0 + alpha;
+
+	f->c.b0 = (1.0 - cs) * 0.5 / a0;
+	f->c.b1 = (1.0 - cs) / a0;
+	f->c.b2 = f->c.b0;
+	f->c.a1 = -2.0 * cs / a0;
+	f->c.a2 = (1.0 - alpha) / a0;
+}
+
+/*
+ * Notch coefficients from the RBJ audio EQ cookbook, q is the centre frequency over the bandwidth.
+ * Only the coefficients change so the centre can be moved while the filter is running.
+ */
+void biquad_set_notch(struct biquad_filter* f, double center, double rate, double q) {
+	double w0, cs, alpha, a0;
+
+	w0 = 2.0 * M_PI * limit_cutoff(center, rate) / rate;
+	cs = cos(w0);
+	alpha = sin(w0) / (2.0 * q);
+	a0 = 1.0 + alpha;
+
+	f->c.b0 = 1.0 / a0;
+	f->c.b1 = -2.0 * cs / a0;
+	f->c.b2 = f->c.b0;
+	f->c.a1 = f->c.b1;
+	f->c.a2 = (1.0 - alpha) / a0;
+}
+
+void biquad_init_lowpass(struct biquad_filter* f, double cutoff, double rate, double q) {
+	biquad_set_lowpass(f, cutoff, rate, q);
+	biquad_reset(f);
+}
+
+void biquad_init_notch(struct biquad_filter* f, double center, double rate, double q) {
+	biquad_set_notch(f, center, rate, q);
+	biquad_reset(f);
+}
+
+void biquad_reset(struct biquad_filter* f) {
+	memset(f->z1, 0, sizeof(f->z1));
+	memset(f->z2, 0, sizeof(f->z2));
+}
+
+/*
+ * One sample through the transposed direct form II, which only needs two delay elements and keeps
+ * the rounding noise low for the low cutoffs used here
+ */
+double biquad_apply_axis(struct biquad_filter* f, int axis, double x) {
+	double y;
+
+	y = f->c.b0 * x + f->z1[axis];
+	f->z1[axis] = f->c.b1 * x - f->c.a1 * y + f->z2[axis];
+	f->z2[axis] = f->c.b2 * x - f->c.a2 * y;
+
+	return y;
+}
+
+struct vec3 biquad_apply(struct biquad_filter* f, struct vec3 v) {
+	v.x = biquad_apply_axis(f, 0, v.x);
+	v.y = biquad_apply_axis(f, 1, v.y);
+	v.z = biquad_apply_axis(f, 2, v.z);
+
+	return v;
+}
+
+void median3_init(struct median3_filter* f) {
+	memset(f->history, 0, sizeof(f->history));
+	f->pos = 0;
+	f->count = 0;
+}
+
+static double median3(double a, double b, double c) {
+	if(a > b) {
+		if(b > c) {
+			return b;
+		}
+		return a > c ? c : a;
+	}
+	if(a > c) {
+		return a;
+	}
+	return b > c ? c : b;
+}
+
+/*
+ * Replace every axis by the median of its last three samples, until there are three samples the
+ * input is passed through
+ */
+struct vec3 median3_apply(struct median3_filter* f, struct vec3 v) {
+	f->history[f->pos][0] = v.x;
+	f->history[f->pos][1] = v.y;
+	f->history[f->pos][2] = v.z;
+	f->pos = (f->pos + 1) % 3;
+
+	if(f->count < 3) {
+		f->count++;
+		return v;
+	}
+
+	v.x = median3(f->history[0][0], f->history[1][0], f->history[2][0]);
+	v.y = median3(f->history[0][1], f->history[1][1], f->history[2][1]);
+	v.z = median3(f->history[0][2], f->history[1][2], f->history[2][2]);
+
+	return v;
+}
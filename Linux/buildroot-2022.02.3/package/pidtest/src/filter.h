@@ -0,0 +1,76 @@
+#include "gyro.h"
+
+/*
+ * Digital filters for the sensor readings and the derivative term of the controller.
+ *
+ * Every filter works on the three axes at once with the state of each axis next to the others, and
+ * the coefficients are only computed when the filter is configured so applying it is a handful of
+ * multiply-adds.  Nothing is allocated, the filters are plain structs.
+ */
+
+#ifndef _FILTER_H
+#define _FILTER_H
+
+#define FILTER_AXES 3
+
+static const double GYRO_LPF_HZ = 90.0;    /* Gyroscope low pass cutoff */
+static const double DTERM_LPF_HZ = 70.0;   /* Derivative term low pass cutoff */
+static const double FEEDFORWARD_LPF_HZ = 15.0; /* Feed-forward low pass cutoff, the setpoint moves in steps of the angle loop */
+static const double ACCEL_LPF_HZ = 10.0;   /* Accelerometer low pass cutoff */
+static const double BIQUAD_Q = 0.7071;     /* Butterworth response for the low pass biquad */
+static const double NOTCH_Q = 3.0;         /* Centre frequency over the width of the notch */
+
+/*
+ * First order low pass
+ */
+struct pt1_filter {
+	double k;
+	double state[FILTER_AXES];
+};
+
+/*
+ * Second order section, normalised so a0 is 1
+ */
+struct biquad_coeffs {
+	double b0;
+	double b1;
+	double b2;
+	double a1;
+	double a2;
+};
+
+/*
+ * Biquad in transposed direct form II, the two delay elements of every axis are all the state
+ */
+struct biquad_filter {
+	struct biquad_coeffs c;
+	double z1[FILTER_AXES];
+	double z2[FILTER_AXES];
+};
+
+/*
+ * Median of the last three samples, removes single sample spikes
+ */
+struct median3_filter {
+	double history[3][FILTER_AXES];
+	int pos;
+	int count;
+};
+
+void pt1_init(struct pt1_filter*, double, double);
+void pt1_set_cutoff(struct pt1_filter*, double, double);
+double pt1_apply_axis(struct pt1_filter*, int, double);
+struct vec3 pt1_apply(struct pt1_filter*, struct vec3);
+
+void biquad_init_lowpass(struct biquad_filter*, double, double, double);
+void biquad_init_notch(struct biquad_filter*, double, double, double);
+void biquad_set_lowpass(struct biquad_filter*, double, double, double);
+void biquad_set_notch(struct biquad_filter*, double, double, double);
+void biquad_reset(struct biquad_filter*);
+double biquad_apply_axis(struct biquad_filter*, int, double);
+struct vec3 biquad_apply(struct biquad_filter*, struct vec3);
+
+void median3_init(struct median3_filter*);
+struct vec3 median3_apply(struct median3_filter*, struct vec3);
+
+#endif
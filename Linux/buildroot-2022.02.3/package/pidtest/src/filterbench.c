@@ -0,0 +1,100 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gyro.h"
+#include "filter.h"
+#include "timing.h"
+
+/*
+ * Cost of the filters in filter.c per sample and axis (make filterbench).  Run it on the target to
+ * see how much of the loop budget a filter chain takes at a given loop rate.
+ */
+
+#define BENCH_INPUTS 1024
+
+static const double LOOP_RATE = 1000.0;    /* Sample rate the filters are designed for */
+static const double MIN_BENCH_TIME = 0.25; /* Time to spend timing each filter */
+
+enum bench_filter {
+	BENCH_PT1,
+	BENCH_LOWPASS,
+	BENCH_NOTCH,
+	BENCH_MEDIAN3,
+	BENCH_COUNT
+};
+
+static const char* BENCH_NAMES[BENCH_COUNT] = { "pt1", "biquad lpf", "biquad notch", "median3" };
+
+/*
+ * Run one filter over the inputs until enough time has passed, in nanoseconds per sample per axis
+ */
+static double bench(enum bench_filter type, const struct vec3* inputs) {
+	struct pt1_filter pt1;
+	struct biquad_filter biquad;
+	struct median3_filter median;
+	struct vec3 out, sum;
+	double start, elapsed;
+	long samples;
+	int i;
+
+	pt1_init(&pt1, GYRO_LPF_HZ, LOOP_RATE);
+	biquad_init_lowpass(&biquad, GYRO_LPF_HZ, LOOP_RATE, BIQUAD_Q);
+	if(type == BENCH_NOTCH) {
+		biquad_init_notch(&biquad, 200.0, LOOP_RATE, NOTCH_Q);
+	}
+	median3_init(&median);
+
+	sum.x = 0.0;
+	sum.y = 0.0;
+	sum.z = 0.0;
+	samples = 0;
+	start = now();
+	do {
+		for(i = 0; i < BENCH_INPUTS; i++) {
+			switch(type) {
+			case BENCH_PT1:
+				out = pt1_apply(&pt1, inputs[i]);
+				break;
+			case BENCH_LOWPASS:
+			case BENCH_NOTCH:
+				out = biquad_apply(&biquad, inputs[i]);
+				break;
+			default:
+				out = median3_apply(&median, inputs[i]);
+				break;
+			}
+			sum.x += out.x;
+			sum.y += out.y;
+			sum.z += out.z;
+		}
+		samples += BENCH_INPUTS;
+		elapsed = now() - start;
+	} while(elapsed < MIN_BENCH_TIME);
+
+	/* Use the result so the filter can't be optimised out */
+	if(isnan(sum.x + sum.y + sum.z)) {
+		printf("The %s filter went unstable\r\n", BENCH_NAMES[type]);
+		exit(1);
+	}
+
+	return elapsed * 1e9 / (samples * FILTER_AXES);
+}
+
+int main(void) {
+	struct vec3 inputs[BENCH_INPUTS];
+	int i;
+
+	for(i = 0; i < BENCH_INPUTS; i++) {
+		inputs[i].x = 100.0 * sin(0.1 * i) + rand() % 7;
+		inputs[i].y = 50.0 * cos(0.37 * i) - rand() % 5;
+		inputs[i].z = 10.0 * sin(1.3 * i) + rand() % 3;
+	}
+
+	printf("%-14s %20s\r\n", "filter", "ns / sample / axis");
+	for(i = 0; i < BENCH_COUNT; i++) {
+		printf("%-14s %20.1f\r\n", BENCH_NAMES[i], bench(i, inputs));
+	}
+
+	return 0;
+}
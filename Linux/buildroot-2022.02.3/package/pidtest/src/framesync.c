@@ -0,0 +1,67 @@
+#include <math.h>
+#include <time.h>
+
+#include "framesync.h"
+
+double frame_sync_clock(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/*
+ * Start from a frame boundary at epoch and frames of hz
+ */
+void frame_sync_init(struct frame_sync* fs, double epoch, double hz) {
+	fs->epoch = epoch;
+	fs->period = 1.0 / hz;
+	fs->cycle = 0.0;
+	fs->loop = 0.0;
+	fs->last = -1.0;
+	fs->target = epoch;
+	histogram_init(&fs->modelled, 0.0, 2.0 * fs->period);
+}
+
+/*
+ * First frame boundary after t
+ */
+static double next_boundary(struct frame_sync* fs, double t) {
+	return fs->epoch + (floor((t - fs->epoch) / fs->period) + 1.0) * fs->period;
+}
+
+/*
+ * Call at the start of every iteration with t the time its sensors were sampled, returns 1 if this
+ * iteration has to write the motors because the next one would start too late to make the frame.
+ *
+ * cycle runs from the sample to the end of the write, so this iteration's write ends at t + cycle.
+ * The next iteration samples at about t + loop and ends its write at t + loop + cycle, it still
+ * makes the target if that is at least FRAME_GUARD before it.
+ */
+int frame_sync_due(struct frame_sync* fs, double t) {
+	if(fs->last >= 0.0 && t - fs->last < FRAME_MAX_CYCLE) {
+		fs->loop += FRAME_SMOOTHING * ((t - fs->last) - fs->loop);
+	}
+	fs->last = t;
+
+	if(fs->period <= fs->loop + fs->cycle) {
+		return 1;
+	}
+
+	/* The first boundary this iteration can still make */
+	fs->target = next_boundary(fs, t + fs->cycle + FRAME_GUARD);
+
+	return fs->target - FRAME_GUARD - t < fs->loop + fs->cycle;
+}
+
+/*
+ * Record a write of the motors that ended at written for sensors sampled at sampled
+ */
+void frame_sync_done(struct frame_sync* fs, double sampled, double written) {
+	if(written - sampled < FRAME_MAX_CYCLE) {
+		fs->cycle += FRAME_SMOOTHING * ((written - sampled) - fs->cycle);
+	}
+
+	histogram_add(&fs->modelled, next_boundary(fs, written) - sampled);
+}
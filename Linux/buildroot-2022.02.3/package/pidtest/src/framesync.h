@@ -0,0 +1,46 @@
+#include "histogram.h"
+
+/*
+ * Motor writes timed against the frames of the PWM controller.
+ *
+ * The PCA9685 only picks up new pulse widths at the start of its next frame, so a write that just
+ * missed a frame boundary waits almost a whole period (20 ms at 50 Hz) before the ESCs see it.  The
+ * phase of the frames is known from the restart in set_pwm_frequency() and the period from the
+ * oscillator, so the loop can write only on the last iteration that still makes the next frame.
+ * The loop releases (periodic.h) are phased against the same epoch so that iteration starts just
+ * before the boundary instead of being delayed by a second sleep.  When the frames are shorter than
+ * the loop every iteration writes.
+ *
+ * The frames are only a model.  Their phase is taken once at the restart and their period from the
+ * oscillator figure, neither is ever observed again because the chip has no way to report where
+ * its counter is.  A few % of oscillator error moves the real frames by a whole period within
+ * seconds, so the alignment is best effort and the time from the sensor sample to the modelled
+ * frame boundary is collected as an estimate only, it is not a measured output latency and is not
+ * fed to the predictor.
+ *
+ * Times are seconds on CLOCK_MONOTONIC.
+ */
+
+#ifndef _FRAMESYNC_H
+#define _FRAMESYNC_H
+
+static const double FRAME_GUARD = 0.0003;     /* Margin left between the end of the write and the frame boundary */
+static const double FRAME_SMOOTHING = 0.05;   /* Weight of a new cycle or loop time measurement */
+static const double FRAME_MAX_CYCLE = 0.005;  /* Longer cycles are stalls and not learned from */
+
+struct frame_sync {
+	double epoch;      /* Start of a frame */
+	double period;     /* Frame length */
+	double cycle;      /* Smoothed time from the sensor sample to the end of the motor write */
+	double loop;       /* Smoothed time between the sensor samples of two iterations */
+	double last;       /* Sensor sample of the previous iteration, negative before the first */
+	double target;     /* Frame boundary the current iteration is aiming for */
+	struct histogram modelled; /* Sensor sample to the modelled frame boundary after the write */
+};
+
+double frame_sync_clock(void);
+void frame_sync_init(struct frame_sync*, double, double);
+int frame_sync_due(struct frame_sync*, double);
+void frame_sync_done(struct frame_sync*, double, double);
+
+#endif
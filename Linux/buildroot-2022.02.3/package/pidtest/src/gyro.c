@@ -189,43 +189,65 @@ int read_raw_gyro(int file, __u8 address) {
 }
 
 /*
- * Get the full state of the gyroscope
+ * Get only the rates from the gyroscope, for loops that don't need the accelerometer every time
  */
-struct gyro_state get_gyro_state(int file) {
-	struct gyro_state g_state;
-
-	struct vec3 raw_a;
+struct vec3 get_gyro_rates(int file) {
 	struct vec3 raw_w;
-	int raw_temp;
+	struct vec3 w;
 
 	const double TWO_POW_FIFTEEN = 32768;
 
-	/* Read the data from the accelerometer */
-	raw_a.x = read_raw_gyro(file, ACCEL_XOUT_H);
-	raw_a.y = read_raw_gyro(file, ACCEL_YOUT_H);
-	raw_a.z = read_raw_gyro(file, ACCEL_ZOUT_H);
-
 	/* Read the data from the gyroscope */
 	raw_w.x = read_raw_gyro(file, GYRO_XOUT_H);
 	raw_w.y = read_raw_gyro(file, GYRO_YOUT_H);
 	raw_w.z = read_raw_gyro(file, GYRO_ZOUT_H);
 
-	/* Read data from the thermometer */
-	raw_temp = read_raw_gyro(file, TEMP_OUT_H);
-
 	/*
-	 * Magic "2.0" number comes from above table about meters per second squared.
+	 * Magic "250.0" number comes from above table about degrees per second.
 	 */
-	g_state.a.x = (raw_a.x / TWO_POW_FIFTEEN) * 2.0;
-	g_state.a.y = (raw_a.y / TWO_POW_FIFTEEN) * 2.0;
-	g_state.a.z = (raw_a.z / TWO_POW_FIFTEEN) * 2.0;
+	w.x = (raw_w.x / TWO_POW_FIFTEEN) * 250.0;
+	w.y = (raw_w.y / TWO_POW_FIFTEEN) * 250.0;
+	w.z = (raw_w.z / TWO_POW_FIFTEEN) * 250.0;
+
+	return w;
+}
+
+/*
+ * Get only the accelerometer reading
+ */
+struct vec3 get_accel_state(int file) {
+	struct vec3 raw_a;
+	struct vec3 a;
+
+	const double TWO_POW_FIFTEEN = 32768;
+
+	/* Read the data from the accelerometer */
+	raw_a.x = read_raw_gyro(file, ACCEL_XOUT_H);
+	raw_a.y = read_raw_gyro(file, ACCEL_YOUT_H);
+	raw_a.z = read_raw_gyro(file, ACCEL_ZOUT_H);
 
 	/*
-	 * Magic "250.0" number comes from above table about degrees per second.
+	 * Magic "2.0" number comes from above table about meters per second squared.
 	 */
-	g_state.w.x = (raw_w.x / TWO_POW_FIFTEEN) * 250.0;
-	g_state.w.y = (raw_w.y / TWO_POW_FIFTEEN) * 250.0;
-	g_state.w.z = (raw_w.z / TWO_POW_FIFTEEN) * 250.0;
+	a.x = (raw_a.x / TWO_POW_FIFTEEN) * 2.0;
+	a.y = (raw_a.y / TWO_POW_FIFTEEN) * 2.0;
+	a.z = (raw_a.z / TWO_POW_FIFTEEN) * 2.0;
+
+	return a;
+}
+
+/*
+ * Get the full state of the gyroscope
+ */
+struct gyro_state get_gyro_state(int file) {
+	struct gyro_state g_state;
+	int raw_temp;
+
+	g_state.a = get_accel_state(file);
+	g_state.w = get_gyro_rates(file);
+
+	/* Read data from the thermometer */
+	raw_temp = read_raw_gyro(file, TEMP_OUT_H);
 
 	g_state.temp = ((raw_temp) / 333.87) + 21.0;
 
@@ -56,6 +56,8 @@ static int read_raw_mag(int, __u8);
 int setup_gyro(int);
 int setup_mag(int);
 struct gyro_state get_gyro_state(int);
+struct vec3 get_gyro_rates(int);
+struct vec3 get_accel_state(int);
 struct vec3 get_mag_state(int);
 
 #endif
@@ -0,0 +1,98 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "histogram.h"
+
+/*
+ * Spread the bins evenly over [low, high)
+ */
+void histogram_init(struct histogram* h, double low, double high) {
+	h->low = low;
+	h->width = (high - low) / HISTOGRAM_BINS;
+	histogram_reset(h);
+}
+
+void histogram_reset(struct histogram* h) {
+	memset(h->bins, 0, sizeof(h->bins));
+	h->count = 0;
+	h->min = INFINITY;
+	h->max = -INFINITY;
+	h->sum = 0.0;
+}
+
+void histogram_add(struct histogram* h, double x) {
+	int bin;
+
+	bin = (int)floor((x - h->low) / h->width);
+	if(bin < 0) {
+		bin = 0;
+	} else if(bin >= HISTOGRAM_BINS) {
+		bin = HISTOGRAM_BINS - 1;
+	}
+
+	h->bins[bin]++;
+	h->count++;
+	h->sum += x;
+	if(x < h->min) {
+		h->min = x;
+	}
+	if(x > h->max) {
+		h->max = x;
+	}
+}
+
+double histogram_mean(const struct histogram* h) {
+	return h->count > 0 ? h->sum / h->count : 0.0;
+}
+
+/*
+ * Value below which a fraction p (0 to 1) of the samples fall, interpolated inside the bin and
+ * kept within the observed minimum and maximum.  0 for an empty histogram.
+ */
+double histogram_percentile(const struct histogram* h, double p) {
+	double rank, seen, x;
+	int i;
+
+	if(h->count == 0) {
+		return 0.0;
+	}
+
+	rank = p * h->count;
+	seen = 0.0;
+	for(i = 0; i < HISTOGRAM_BINS; i++) {
+		if(h->bins[i] > 0 && seen + h->bins[i] >= rank) {
+			x = h->low + h->width * (i + (rank - seen) / h->bins[i]);
+			return fmax(h->min, fmin(h->max, x));
+		}
+		seen += h->bins[i];
+	}
+
+	return h->max;
+}
+
+/*
+ * Print the summary and every bin that has samples, the values are multiplied by scale (e.g. 1e6
+ * to print seconds in us)
+ */
+void histogram_print(const struct histogram* h, const char* name, double scale, const char* unit) {
+	int i;
+
+	if(h->count == 0) {
+		printf("%s: no samples\r\n", name);
+		return;
+	}
+
+	printf("%s: %lu samples, min %.1f mean %.1f p50 %.1f p99 %.1f p99.9 %.1f max %.1f %s\r\n", name, h->count,
+		h->min * scale, histogram_mean(h) * scale, histogram_percentile(h, 0.5) * scale,
+		histogram_percentile(h, 0.99) * scale, histogram_percentile(h, 0.999) * scale, h->max * scale, unit);
+
+	for(i = 0; i < HISTOGRAM_BINS; i++) {
+		if(h->bins[i] > 0) {
+			/* The first and last bins also hold everything outside the range */
+			printf("  %10.1f - %10.1f %s %10lu\r\n", (i == 0 ? fmin(h->low, h->min) : h->low + h->width * i) * scale,
+				(i == HISTOGRAM_BINS - 1 ? fmax(h->low + h->width * HISTOGRAM_BINS, h->max) : h->low + h->width * (i + 1)) * scale,
+				unit, h->bins[i]);
+		}
+	}
+}
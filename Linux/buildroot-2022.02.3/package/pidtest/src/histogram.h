@@ -0,0 +1,31 @@
+/*
+ * Fixed bin histogram for timing distributions measured on the real time thread.
+ *
+ * The range is set once and adding a value is a division and an increment, nothing is allocated so
+ * a histogram can be filled in the loop and copied out as a plain struct.  Values outside the range
+ * are counted in the first or last bin and still count towards the minimum and maximum.
+ */
+
+#ifndef _HISTOGRAM_H
+#define _HISTOGRAM_H
+
+#define HISTOGRAM_BINS 64
+
+struct histogram {
+	double low;
+	double width;     /* Width of one bin */
+	unsigned long bins[HISTOGRAM_BINS];
+	unsigned long count;
+	double min;
+	double max;
+	double sum;
+};
+
+void histogram_init(struct histogram*, double, double);
+void histogram_reset(struct histogram*);
+void histogram_add(struct histogram*, double);
+double histogram_mean(const struct histogram*);
+double histogram_percentile(const struct histogram*, double);
+void histogram_print(const struct histogram*, const char*, double, const char*);
+
+#endif
@@ -3,17 +3,26 @@
 #include <math.h>
 
 #include "gyro.h"
+#include "quaternion.h"
 #include "madgwick.h"
+#include "fastmath.h"
 
 /*
- * Get an euler heading angle derived from the accelerometer, magnetometer and gyroscope readings
+ * Reset the filter to the identity attitude with the default gain
  */
-struct vec3 get_angle(struct vec3 w, struct vec3 a, struct vec3 m, double deltat) {
-	static struct quaternion q = { 1, 0, 0, 0 };
+void madgwick_init(struct madgwick_filter* f) {
+	f->q = QUAT_IDENTITY;
+	f->beta = BETA;
+}
+
+/*
+ * Compute the normalised gradient decent step for the accelerometer and magnetometer readings.
+ * Returns 0 if the readings can't be normalised.
+ */
+static int madgwick_gradient(struct quaternion q, struct vec3 a, struct vec3 m, float s[4]) {
 	float norm;
 	float hx, hy, _2bx, _2bz;
 	float s1, s2, s3, s4;
-	float qDot1, qDot2, qDot3, qDot4;
 	/* Variables to avoid repeated arithmetic */
 	float _2q1mx;
 	float _2q1my;
@@ -38,27 +47,22 @@ struct vec3 get_angle(struct vec3 w, struct vec3 a, struct vec3 m, double deltat
 	float q3q4 = q.q3 * q.q4;
 	float q4q4 = q.q4 * q.q4;
 
-	/* Convert degrees to radians */
-	w.x *= 0.017453;
-	w.y *= 0.017453;
-	w.z *= 0.017453;
-
 	/* Normalise accelerometer measurement */
-	norm = sqrt(a.x * a.x + a.y * a.y + a.z * a.z);
+	norm = a.x * a.x + a.y * a.y + a.z * a.z;
 	if (norm == 0.0f) {
-		return a; /* Handle a possible NaN (a will always equal [0, 0, 0]) */
+		return 0; /* Handle a possible NaN (a will always equal [0, 0, 0]) */
 	}
-	norm = 1.0f/norm;
+	norm = RSQRT(norm);
 	a.x *= norm;
 	a.y *= norm;
 	a.z *= norm;
 
 	/* Normalise magnetometer measurementa */
-	norm = sqrt(m.x * m.x + m.y * m.y + m.z * m.z);
+	norm = m.x * m.x + m.y * m.y + m.z * m.z;
 	if (norm == 0.0f) {
-		return m; /* Handle a possible NaN (m will always equal [0, 0, 0]) */ 
+		return 0; /* Handle a possible NaN (m will always equal [0, 0, 0]) */
 	}
-	norm = 1.0f/norm;
+	norm = RSQRT(norm);
 	m.x *= norm;
 	m.y *= norm;
 	m.z *= norm;
@@ -75,7 +79,7 @@ struct vec3 get_angle(struct vec3 w, struct vec3 a, struct vec3 m, double deltat
 	hx = m.x * q1q1 - _2q1my * q.q4 + _2q1mz * q.q3 + m.x * q2q2 + _2q2 * m.y * q.q3 + _2q2 * m.z * q.q4 - m.x * q3q3 - m.x * q4q4;
 	hy = _2q1mx * q.q4 + m.y * q1q1 - _2q1mz * q.q2 + _2q2mx * q.q3 - m.y * q2q2 + m.y * q3q3 + _2q3 * m.z * q.q4 - m.y * q4q4;
 	
-	_2bx = sqrt(hx * hx + hy * hy);
+	_2bx = SQRT(hx * hx + hy * hy);
 	_2bz = -_2q1mx * q.q3 + _2q1my * q.q2 + m.z * q1q1 + _2q2mx * q.q4 - m.z * q2q2 + _2q3 * m.y * q.q4 - m.z * q3q3 + m.z * q4q4;
 	_4bx = 2.0f * _2bx;
 	_4bz = 2.0f * _2bz;
@@ -87,18 +91,41 @@ struct vec3 get_angle(struct vec3 w, struct vec3 a, struct vec3 m, double deltat
 	s4 = _2q2 * (2.0f * q2q4 - _2q1q3 - a.x) + _2q3 * (2.0f * q1q2 + _2q3q4 - a.y) + (-_4bx * q.q4 + _2bz * q.q2) * (_2bx * (0.5f - q3q3 - q4q4) + _2bz * (q2q4 - q1q3) - m.x) + (-_2bx * q.q1 + _2bz * q.q3) * (_2bx * (q2q3 - q1q4) + _2bz * (q1q2 + q3q4) - m.y) + _2bx * q.q2 * (_2bx * (q1q3 + q2q4) + _2bz * (0.5f - q2q2 - q3q3) - m.z);
 
 	/* Normalise step magnitude */
-	norm = sqrt(s1 * s1 + s2 * s2 + s3 * s3 + s4 * s4);
-	norm = 1.0f/norm;
-	s1 *= norm;
-	s2 *= norm;
-	s3 *= norm;
-	s4 *= norm;
+	norm = RSQRT(s1 * s1 + s2 * s2 + s3 * s3 + s4 * s4);
+	s[0] = s1 * norm;
+	s[1] = s2 * norm;
+	s[2] = s3 * norm;
+	s[3] = s4 * norm;
+
+	/*
+	 * End of black magic zone
+	 */
+
+	return 1;
+}
+
+/*
+ * Get the attitude quaternion derived from the accelerometer, magnetometer and gyroscope readings
+ */
+struct quaternion madgwick_update(struct madgwick_filter* f, struct vec3 w, struct vec3 a, struct vec3 m, double deltat) {
+	struct quaternion q = f->q;
+	float s[4];
+	float qDot1, qDot2, qDot3, qDot4;
+
+	/* Convert degrees to radians */
+	w.x *= 0.017453;
+	w.y *= 0.017453;
+	w.z *= 0.017453;
+
+	if (!madgwick_gradient(q, a, m, s)) {
+		return q; /* Keep the last attitude if the readings are bad */
+	}
 
 	/* Compute rate of change of quaternion */
-	qDot1 = 0.5f * (-q.q2 * w.x - q.q3 * w.y - q.q4 * w.z) - BETA * s1;
-	qDot2 = 0.5f * (q.q1 * w.x + q.q3 * w.z - q.q4 * w.y) - BETA * s2;
-	qDot3 = 0.5f * (q.q1 * w.y - q.q2 * w.z + q.q4 * w.x) - BETA * s3;
-	qDot4 = 0.5f * (q.q1 * w.z + q.q2 * w.y - q.q3 * w.x) - BETA * s4;
+	qDot1 = 0.5f * (-q.q2 * w.x - q.q3 * w.y - q.q4 * w.z) - f->beta * s[0];
+	qDot2 = 0.5f * (q.q1 * w.x + q.q3 * w.z - q.q4 * w.y) - f->beta * s[1];
+	qDot3 = 0.5f * (q.q1 * w.y - q.q2 * w.z + q.q4 * w.x) - f->beta * s[2];
+	qDot4 = 0.5f * (q.q1 * w.z + q.q2 * w.y - q.q3 * w.x) - f->beta * s[3];
 
 	/* Integrate to yield quaternion */
 	q.q1 += qDot1 * deltat;
@@ -106,51 +133,29 @@ struct vec3 get_angle(struct vec3 w, struct vec3 a, struct vec3 m, double deltat
 	q.q3 += qDot3 * deltat;
 	q.q4 += qDot4 * deltat;
 
-	/* Normalise quaternion */
-	norm = sqrt(q.q1 * q.q1 + q.q2 * q.q2 + q.q3 * q.q3 + q.q4 * q.q4);
-	norm = 1.0f/norm;
+	q = quat_normalise(q);
 
-	q.q1 *= norm;
-	q.q2 *= norm;
-	q.q3 *= norm;
-	q.q4 *= norm;
+	f->q = q;
 
-	/*
-	 * End of black magic zone
-	 */
-
-	return to_euler(q);
+	return q;
 }
 
 /*
- * Take a quaternion angle and convert it to a 3D heading euler angle
+ * Apply only the accelerometer and magnetometer correction, deltat is the time the correction is
+ * spread over.  Used together with quat_integrate() when the gyroscope runs faster than the fusion.
  */
-static struct vec3 to_euler(struct quaternion q) {
-	struct vec3 dir;
-	double temp1, temp2;
+void madgwick_correct(struct madgwick_filter* f, struct vec3 a, struct vec3 m, double deltat) {
+	struct quaternion q = f->q;
+	float s[4];
 
-	/* Modified from https://en.wikipedia.org/wiki/Conversion_between_quaternions_and_Euler_angles */
-
-	temp1 = 2 * (q.q4 * q.q1 + q.q2 * q.q3);
-	temp2 = 1 - 2 * (q.q1 * q.q1 + q.q2 * q.q2);
-	dir.x = atan2(temp1, temp2);
-
-	temp1 = 2 * (q.q4 * q.q2 - q.q3 * q.q1);
-	if(abs(temp1) >= 1) {
-		dir.y = copysign(M_PI / 2, temp1);
-	} else { 
-		dir.y = asin(temp1);
+	if (!madgwick_gradient(q, a, m, s)) {
+		return;
 	}
 
-	temp1 = 2 * (q.q4 * q.q3 + q.q1 * q.q2);
-	temp2 = 1 - 2 * (q.q2 * q.q2 + q.q3 * q.q3);
-	dir.z = atan2(temp1, temp2);
-
-	/* Convert back to degrees */
-
-	dir.x *= 57.29577951;
-	dir.y *= 57.29577951;
-	dir.z *= 57.29577951;
+	q.q1 -= f->beta * s[0] * deltat;
+	q.q2 -= f->beta * s[1] * deltat;
+	q.q3 -= f->beta * s[2] * deltat;
+	q.q4 -= f->beta * s[3] * deltat;
 
-	return dir;
+	f->q = quat_normalise(q);
 }
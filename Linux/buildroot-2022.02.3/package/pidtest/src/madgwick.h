@@ -1,5 +1,7 @@
 #include <math.h>
 
+#include "quaternion.h"
+
 /*
  * Code that allows accelerometer, magnetometer and gyroscope readings to be turned into heading
  * for the air craft (AHRS)
@@ -15,15 +17,13 @@
 static const double GYRO_MEAS_ERROR = M_PI * (60.0f / 180.0f); /* Estimated error of the gyroscope */
 static const double BETA = sqrt(3.0f / 4.0f) * GYRO_MEAS_ERROR; /* 2 times the proportional gain */
 
-struct quaternion {
-    double q1;
-    double q2;
-    double q3;
-    double q4;
+struct madgwick_filter {
+	struct quaternion q;
+	double beta;
 };
 
-struct vec3 get_angle(struct vec3, struct vec3, struct vec3, double);
-
-static struct vec3 to_euler(struct quaternion);
+void madgwick_init(struct madgwick_filter*);
+struct quaternion madgwick_update(struct madgwick_filter*, struct vec3, struct vec3, struct vec3, double);
+void madgwick_correct(struct madgwick_filter*, struct vec3, struct vec3, double);
 
 #endif
@@ -0,0 +1,112 @@
+#include <math.h>
+
+#include "simd.h"
+#include "madgwick_simd.h"
+
+/*
+ * Tiny value added under the square roots so a lane with an all zero reading can't produce a NaN,
+ * lanes can't take an early exit like the scalar filter does
+ */
+static const float NORM_EPSILON = 1e-20f;
+
+/*
+ * Reset every lane to the identity attitude with the gains in beta
+ */
+void madgwick_lanes_init(struct madgwick_lanes* f, vfloat beta) {
+	f->q1 = v_set1(1.0f);
+	f->q2 = v_set1(0.0f);
+	f->q3 = v_set1(0.0f);
+	f->q4 = v_set1(0.0f);
+	f->beta = beta;
+}
+
+/*
+ * Advance every lane by one sample, this is madgwick_update() with the scalars swapped for vectors
+ */
+void madgwick_lanes_update(struct madgwick_lanes* f, const struct lane_sample* in) {
+	vfloat q1 = f->q1, q2 = f->q2, q3 = f->q3, q4 = f->q4;
+	vfloat wx, wy, wz, ax, ay, az, mx, my, mz;
+	vfloat norm;
+	vfloat hx, hy, _2bx, _2bz;
+	vfloat s1, s2, s3, s4;
+	vfloat qDot1, qDot2, qDot3, qDot4;
+	vfloat _2q1mx, _2q1my, _2q1mz, _2q2mx, _4bx, _4bz;
+	vfloat _2q1 = 2.0f * q1;
+	vfloat _2q2 = 2.0f * q2;
+	vfloat _2q3 = 2.0f * q3;
+	vfloat _2q4 = 2.0f * q4;
+	vfloat _2q1q3 = 2.0f * q1 * q3;
+	vfloat _2q3q4 = 2.0f * q3 * q4;
+	vfloat q1q1 = q1 * q1;
+	vfloat q1q2 = q1 * q2;
+	vfloat q1q3 = q1 * q3;
+	vfloat q1q4 = q1 * q4;
+	vfloat q2q2 = q2 * q2;
+	vfloat q2q3 = q2 * q3;
+	vfloat q2q4 = q2 * q4;
+	vfloat q3q3 = q3 * q3;
+	vfloat q3q4 = q3 * q4;
+	vfloat q4q4 = q4 * q4;
+
+	/* Convert degrees to radians */
+	wx = in->wx * 0.017453f;
+	wy = in->wy * 0.017453f;
+	wz = in->wz * 0.017453f;
+
+	/* Normalise accelerometer measurement */
+	norm = 1.0f / v_sqrt(in->ax * in->ax + in->ay * in->ay + in->az * in->az + NORM_EPSILON);
+	ax = in->ax * norm;
+	ay = in->ay * norm;
+	az = in->az * norm;
+
+	/* Normalise magnetometer measurement */
+	norm = 1.0f / v_sqrt(in->mx * in->mx + in->my * in->my + in->mz * in->mz + NORM_EPSILON);
+	mx = in->mx * norm;
+	my = in->my * norm;
+	mz = in->mz * norm;
+
+	/* Reference direction of Earth's magnetic field */
+	_2q1mx = 2.0f * q1 * mx;
+	_2q1my = 2.0f * q1 * my;
+	_2q1mz = 2.0f * q1 * mz;
+	_2q2mx = 2.0f * q2 * mx;
+	hx = mx * q1q1 - _2q1my * q4 + _2q1mz * q3 + mx * q2q2 + _2q2 * my * q3 + _2q2 * mz * q4 - mx * q3q3 - mx * q4q4;
+	hy = _2q1mx * q4 + my * q1q1 - _2q1mz * q2 + _2q2mx * q3 - my * q2q2 + my * q3q3 + _2q3 * mz * q4 - my * q4q4;
+
+	_2bx = v_sqrt(hx * hx + hy * hy);
+	_2bz = -_2q1mx * q3 + _2q1my * q2 + mz * q1q1 + _2q2mx * q4 - mz * q2q2 + _2q3 * my * q4 - mz * q3q3 + mz * q4q4;
+	_4bx = 2.0f * _2bx;
+	_4bz = 2.0f * _2bz;
+
+	/* Gradient decent algorithm corrective step */
+	s1 = -_2q3 * (2.0f * q2q4 - _2q1q3 - ax) + _2q2 * (2.0f * q1q2 + _2q3q4 - ay) - _2bz * q3 * (_2bx * (0.5f - q3q3 - q4q4) + _2bz * (q2q4 - q1q3) - mx) + (-_2bx * q4 + _2bz * q2) * (_2bx * (q2q3 - q1q4) + _2bz * (q1q2 + q3q4) - my) + _2bx * q3 * (_2bx * (q1q3 + q2q4) + _2bz * (0.5f - q2q2 - q3q3) - mz);
+	s2 = _2q4 * (2.0f * q2q4 - _2q1q3 - ax) + _2q1 * (2.0f * q1q2 + _2q3q4 - ay) - 4.0f * q2 * (1.0f - 2.0f * q2q2 - 2.0f * q3q3 - az) + _2bz * q4 * (_2bx * (0.5f - q3q3 - q4q4) + _2bz * (q2q4 - q1q3) - mx) + (_2bx * q3 + _2bz * q1) * (_2bx * (q2q3 - q1q4) + _2bz * (q1q2 + q3q4) - my) + (_2bx * q4 - _4bz * q2) * (_2bx * (q1q3 + q2q4) + _2bz * (0.5f - q2q2 - q3q3) - mz);
+	s3 = -_2q1 * (2.0f * q2q4 - _2q1q3 - ax) + _2q4 * (2.0f * q1q2 + _2q3q4 - ay) - 4.0f * q3 * (1.0f - 2.0f * q2q2 - 2.0f * q3q3 - az) + (-_4bx * q3 - _2bz * q1) * (_2bx * (0.5f - q3q3 - q4q4) + _2bz * (q2q4 - q1q3) - mx) + (_2bx * q2 + _2bz * q4) * (_2bx * (q2q3 - q1q4) + _2bz * (q1q2 + q3q4) - my) + (_2bx * q1 - _4bz * q3) * (_2bx * (q1q3 + q2q4) + _2bz * (0.5f - q2q2 - q3q3) - mz);
+	s4 = _2q2 * (2.0f * q2q4 - _2q1q3 - ax) + _2q3 * (2.0f * q1q2 + _2q3q4 - ay) + (-_4bx * q4 + _2bz * q2) * (_2bx * (0.5f - q3q3 - q4q4) + _2bz * (q2q4 - q1q3) - mx) + (-_2bx * q1 + _2bz * q3) * (_2bx * (q2q3 - q1q4) + _2bz * (q1q2 + q3q4) - my) + _2bx * q2 * (_2bx * (q1q3 + q2q4) + _2bz * (0.5f - q2q2 - q3q3) - mz);
+
+	/* Normalise step magnitude */
+	norm = 1.0f / v_sqrt(s1 * s1 + s2 * s2 + s3 * s3 + s4 * s4 + NORM_EPSILON);
+	s1 *= norm;
+	s2 *= norm;
+	s3 *= norm;
+	s4 *= norm;
+
+	/* Compute rate of change of quaternion */
+	qDot1 = 0.5f * (-q2 * wx - q3 * wy - q4 * wz) - f->beta * s1;
+	qDot2 = 0.5f * (q1 * wx + q3 * wz - q4 * wy) - f->beta * s2;
+	qDot3 = 0.5f * (q1 * wy - q2 * wz + q4 * wx) - f->beta * s3;
+	qDot4 = 0.5f * (q1 * wz + q2 * wy - q3 * wx) - f->beta * s4;
+
+	/* Integrate to yield quaternion */
+	q1 += qDot1 * in->dt;
+	q2 += qDot2 * in->dt;
+	q3 += qDot3 * in->dt;
+	q4 += qDot4 * in->dt;
+
+	/* Normalise quaternion */
+	norm = 1.0f / v_sqrt(q1 * q1 + q2 * q2 + q3 * q3 + q4 * q4);
+	f->q1 = q1 * norm;
+	f->q2 = q2 * norm;
+	f->q3 = q3 * norm;
+	f->q4 = q4 * norm;
+}
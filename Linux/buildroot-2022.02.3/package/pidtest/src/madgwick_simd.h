@@ -0,0 +1,33 @@
+#include "simd.h"
+
+/*
+ * The Madgwick filter running SIMD_LANES independent instances at once for the offline replay
+ * tools.  The state is kept as structure of arrays, one vector per quaternion component, so each
+ * instruction advances every lane, and every lane can have its own gain.
+ */
+
+#ifndef _MADGWICK_SIMD_H
+#define _MADGWICK_SIMD_H
+
+struct madgwick_lanes {
+	vfloat q1;
+	vfloat q2;
+	vfloat q3;
+	vfloat q4;
+	vfloat beta;
+};
+
+/*
+ * One sample for every lane, in the same units as gyro.c
+ */
+struct lane_sample {
+	vfloat dt;
+	vfloat wx, wy, wz;
+	vfloat ax, ay, az;
+	vfloat mx, my, mz;
+};
+
+void madgwick_lanes_init(struct madgwick_lanes*, vfloat);
+void madgwick_lanes_update(struct madgwick_lanes*, const struct lane_sample*);
+
+#endif
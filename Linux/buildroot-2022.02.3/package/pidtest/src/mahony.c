@@ -0,0 +1,155 @@
+#include <math.h>
+
+#include "gyro.h"
+#include "quaternion.h"
+#include "mahony.h"
+#include "fastmath.h"
+
+/*
+ * Reset the filter to the identity attitude with the default gains
+ */
+void mahony_init(struct mahony_filter* f) {
+	f->q = QUAT_IDENTITY;
+	f->integral.x = 0;
+	f->integral.y = 0;
+	f->integral.z = 0;
+	f->kp = MAHONY_KP;
+	f->ki = MAHONY_KI;
+}
+
+/*
+ * Compute the error between the measured and estimated gravity and magnetic field directions.
+ * Returns 0 if the readings can't be normalised.
+ */
+static int mahony_error(struct quaternion q, struct vec3 a, struct vec3 m, struct vec3* e) {
+	double norm;
+	double hx, hy, bx, bz;
+	double vx, vy, vz, wx, wy, wz;
+	double q1q1 = q.q1 * q.q1;
+	double q1q2 = q.q1 * q.q2;
+	double q1q3 = q.q1 * q.q3;
+	double q1q4 = q.q1 * q.q4;
+	double q2q2 = q.q2 * q.q2;
+	double q2q3 = q.q2 * q.q3;
+	double q2q4 = q.q2 * q.q4;
+	double q3q3 = q.q3 * q.q3;
+	double q3q4 = q.q3 * q.q4;
+	double q4q4 = q.q4 * q.q4;
+
+	/* Normalise accelerometer measurement */
+	norm = a.x * a.x + a.y * a.y + a.z * a.z;
+	if (norm == 0.0) {
+		return 0; /* Handle a possible NaN */
+	}
+	norm = RSQRT(norm);
+	a.x *= norm;
+	a.y *= norm;
+	a.z *= norm;
+
+	/* Normalise magnetometer measurement */
+	norm = m.x * m.x + m.y * m.y + m.z * m.z;
+	if (norm == 0.0) {
+		return 0; /* Handle a possible NaN */
+	}
+	norm = RSQRT(norm);
+	m.x *= norm;
+	m.y *= norm;
+	m.z *= norm;
+
+	/* Reference direction of Earth's magnetic field */
+	hx = 2.0 * m.x * (0.5 - q3q3 - q4q4) + 2.0 * m.y * (q2q3 - q1q4) + 2.0 * m.z * (q2q4 + q1q3);
+	hy = 2.0 * m.x * (q2q3 + q1q4) + 2.0 * m.y * (0.5 - q2q2 - q4q4) + 2.0 * m.z * (q3q4 - q1q2);
+	bx = SQRT(hx * hx + hy * hy);
+	bz = 2.0 * m.x * (q2q4 - q1q3) + 2.0 * m.y * (q3q4 + q1q2) + 2.0 * m.z * (0.5 - q2q2 - q3q3);
+
+	/* Estimated direction of gravity and magnetic field */
+	vx = 2.0 * (q2q4 - q1q3);
+	vy = 2.0 * (q1q2 + q3q4);
+	vz = q1q1 - q2q2 - q3q3 + q4q4;
+	wx = 2.0 * bx * (0.5 - q3q3 - q4q4) + 2.0 * bz * (q2q4 - q1q3);
+	wy = 2.0 * bx * (q2q3 - q1q4) + 2.0 * bz * (q1q2 + q3q4);
+	wz = 2.0 * bx * (q1q3 + q2q4) + 2.0 * bz * (0.5 - q2q2 - q3q3);
+
+	/* Error is the cross product between estimated direction and measured direction of the fields */
+	e->x = (a.y * vz - a.z * vy) + (m.y * wz - m.z * wy);
+	e->y = (a.z * vx - a.x * vz) + (m.z * wx - m.x * wz);
+	e->z = (a.x * vy - a.y * vx) + (m.x * wy - m.y * wx);
+
+	return 1;
+}
+
+/*
+ * Accumulate the integral feedback, only when it is used so it can't wind up
+ */
+static void mahony_integrate_error(struct mahony_filter* f, struct vec3 e, double deltat) {
+	if (f->ki > 0.0) {
+		f->integral.x += e.x * deltat;
+		f->integral.y += e.y * deltat;
+		f->integral.z += e.z * deltat;
+	} else {
+		f->integral.x = 0.0;
+		f->integral.y = 0.0;
+		f->integral.z = 0.0;
+	}
+}
+
+/*
+ * Get the attitude quaternion derived from the accelerometer, magnetometer and gyroscope readings
+ */
+struct quaternion mahony_update(struct mahony_filter* f, struct vec3 w, struct vec3 a, struct vec3 m, double deltat) {
+	struct vec3 e;
+
+	/* Convert degrees to radians */
+	w.x *= 0.017453;
+	w.y *= 0.017453;
+	w.z *= 0.017453;
+
+	if (!mahony_error(f->q, a, m, &e)) {
+		return f->q; /* Keep the last attitude if the readings are bad */
+	}
+
+	mahony_integrate_error(f, e, deltat);
+
+	/* Apply the PI feedback to the gyroscope rates */
+	w.x += f->kp * e.x + f->ki * f->integral.x;
+	w.y += f->kp * e.y + f->ki * f->integral.y;
+	w.z += f->kp * e.z + f->ki * f->integral.z;
+
+	f->q = quat_normalise(quat_integrate(f->q, w, deltat));
+
+	return f->q;
+}
+
+/*
+ * Apply only the accelerometer and magnetometer correction, deltat is the time the correction is
+ * spread over.  The integral term is not applied here since it is a gyro bias estimate, it is added
+ * to the rates when propagating (see mahony_bias()).
+ */
+void mahony_correct(struct mahony_filter* f, struct vec3 a, struct vec3 m, double deltat) {
+	struct vec3 e;
+
+	if (!mahony_error(f->q, a, m, &e)) {
+		return;
+	}
+
+	mahony_integrate_error(f, e, deltat);
+
+	e.x *= f->kp;
+	e.y *= f->kp;
+	e.z *= f->kp;
+
+	f->q = quat_normalise(quat_integrate(f->q, e, deltat));
+}
+
+/*
+ * Get the gyroscope bias correction in radians per second to add to the rates when propagating
+ */
+struct vec3 mahony_bias(struct mahony_filter* f) {
+	struct vec3 b;
+
+	b.x = f->ki * f->integral.x;
+	b.y = f->ki * f->integral.y;
+	b.z = f->ki * f->integral.z;
+
+	return b;
+}
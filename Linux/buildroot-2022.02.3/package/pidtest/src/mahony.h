@@ -0,0 +1,31 @@
+#include "quaternion.h"
+
+/*
+ * Mahony complementary filter, a cheaper alternative to the Madgwick filter that corrects the gyro
+ * with a PI controller on the error between measured and estimated gravity / magnetic field.  The
+ * integral term soaks up the gyroscope bias.
+ *
+ * Modified from the following arduino library:
+ *
+ * https://github.com/kriswiner/MPU9250/blob/master/quaternionFilters.ino
+ */
+
+#ifndef _MAHONY_H
+#define _MAHONY_H
+
+static const double MAHONY_KP = 2.0 * 0.5;  /* 2 times the proportional gain */
+static const double MAHONY_KI = 2.0 * 0.05; /* 2 times the integral gain */
+
+struct mahony_filter {
+	struct quaternion q;
+	struct vec3 integral; /* Integral of the error, in rad/s once scaled by ki */
+	double kp;
+	double ki;
+};
+
+void mahony_init(struct mahony_filter*);
+struct quaternion mahony_update(struct mahony_filter*, struct vec3, struct vec3, struct vec3, double);
+void mahony_correct(struct mahony_filter*, struct vec3, struct vec3, double);
+struct vec3 mahony_bias(struct mahony_filter*);
+
+#endif
@@ -0,0 +1,194 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fastmath.h"
+#include "timing.h"
+
+/*
+ * Accuracy and speed check of fastmath.c against libm (make mathbench).
+ *
+ * Every approximation is swept over its whole input domain and the worst error is compared with the
+ * bound documented in fastmath.h, the tool exits with an error if a bound is broken.  Then each
+ * function and its libm counterpart are timed over the same inputs.  Run it on the target to see
+ * whether FAST_MATH=1 is worth it there.
+ */
+
+#define BENCH_INPUTS 1024
+
+static const uint32_t RSQRT_STRIDE = 257;  /* Step through the float bit patterns */
+static const int ATAN2_ANGLES = 1000000;   /* Angles per radius */
+static const int ASIN_STEPS = 2000000;     /* Steps over [-1, 1] */
+static const double MIN_BENCH_TIME = 0.25; /* Time to spend timing each function */
+
+/*
+ * One argument wrappers so that every function is timed through the same indirect call
+ */
+static double libm_rsqrt(double x) { return 1.0 / sqrt(x); }
+static double fast_rsqrt_wrap(double x) { return fast_rsqrt(x); }
+static double libm_atan2(double x) { return atan2(x, 1.0 - x); }
+static double fast_atan2_wrap(double x) { return fast_atan2(x, 1.0 - x); }
+static double libm_asin(double x) { return asin(x); }
+static double fast_asin_wrap(double x) { return fast_asin(x); }
+
+/*
+ * Print the worst error found for a function, returns 1 if it is within the bound
+ */
+static int report(const char* name, double max_error, double at, double bound) {
+	int ok = max_error <= bound;
+
+	printf("%-8s max error %.3e at %.6g (bound %.1e) %s\r\n", name, max_error, at, bound, ok ? "ok" : "FAILED");
+
+	return ok;
+}
+
+/*
+ * Relative error of fast_rsqrt() and fast_sqrt() over every positive normal float (sampled)
+ */
+static int check_rsqrt(void) {
+	double error, max_rsqrt, max_sqrt, at_rsqrt, at_sqrt, exact;
+	uint32_t i;
+	float x;
+
+	max_rsqrt = 0.0;
+	max_sqrt = 0.0;
+	at_rsqrt = 0.0;
+	at_sqrt = 0.0;
+
+	for(i = 0x00800000; i < 0x7f800000; i += RSQRT_STRIDE) {
+		memcpy(&x, &i, sizeof(x));
+		exact = sqrt((double)x);
+
+		error = fabs(fast_rsqrt(x) * exact - 1.0);
+		if(error > max_rsqrt) {
+			max_rsqrt = error;
+			at_rsqrt = x;
+		}
+
+		error = fabs(fast_sqrt(x) / exact - 1.0);
+		if(error > max_sqrt) {
+			max_sqrt = error;
+			at_sqrt = x;
+		}
+	}
+
+	return report("rsqrt", max_rsqrt, at_rsqrt, FAST_RSQRT_MAX_ERROR) & report("sqrt", max_sqrt, at_sqrt, FAST_RSQRT_MAX_ERROR);
+}
+
+/*
+ * Absolute error of fast_atan2() around circles from tiny to huge radii, including the axes
+ */
+static int check_atan2(void) {
+	static const double radii[] = { 1e-30, 1e-6, 1.0, 1e6, 1e30 };
+	double error, max_error, at, theta, x, y, r;
+	int i, j;
+
+	max_error = 0.0;
+	at = 0.0;
+
+	for(j = 0; j < (int)(sizeof(radii) / sizeof(radii[0])); j++) {
+		r = radii[j];
+		for(i = 0; i <= ATAN2_ANGLES; i++) {
+			theta = -M_PI + 2.0 * M_PI * i / ATAN2_ANGLES;
+			x = r * cos(theta);
+			y = r * sin(theta);
+
+			error = fabs(fast_atan2(y, x) - atan2(y, x));
+			/* -pi and pi are the same angle */
+			if(error > M_PI) {
+				error = fabs(error - 2.0 * M_PI);
+			}
+			if(error > max_error) {
+				max_error = error;
+				at = theta;
+			}
+		}
+
+		/* Exactly on the axes */
+		error = fabs(fast_atan2(0.0, r) - atan2(0.0, r));
+		error = fmax(error, fabs(fast_atan2(r, 0.0) - atan2(r, 0.0)));
+		error = fmax(error, fabs(fast_atan2(0.0, -r) - atan2(0.0, -r)));
+		error = fmax(error, fabs(fast_atan2(-r, 0.0) - atan2(-r, 0.0)));
+		if(error > max_error) {
+			max_error = error;
+			at = 0.0;
+		}
+	}
+
+	return report("atan2", max_error, at, FAST_ATAN2_MAX_ERROR);
+}
+
+/*
+ * Absolute error of fast_asin() over [-1, 1] including both ends
+ */
+static int check_asin(void) {
+	double error, max_error, at, x;
+	int i;
+
+	max_error = 0.0;
+	at = 0.0;
+
+	for(i = 0; i <= ASIN_STEPS; i++) {
+		x = -1.0 + 2.0 * i / ASIN_STEPS;
+		error = fabs(fast_asin(x) - asin(x));
+		if(error > max_error) {
+			max_error = error;
+			at = x;
+		}
+	}
+
+	return report("asin", max_error, at, FAST_ASIN_MAX_ERROR);
+}
+
+/*
+ * Time a function over the inputs, in nanoseconds per call
+ */
+static double bench(double (*fn)(double), const double* inputs) {
+	volatile double sink;
+	double start, elapsed, sum;
+	long calls;
+	int i;
+
+	calls = 0;
+	sum = 0.0;
+	start = now();
+	do {
+		for(i = 0; i < BENCH_INPUTS; i++) {
+			sum += fn(inputs[i]);
+		}
+		calls += BENCH_INPUTS;
+		elapsed = now() - start;
+	} while(elapsed < MIN_BENCH_TIME);
+	sink = sum;
+	(void)sink;
+
+	return elapsed * 1e9 / calls;
+}
+
+int main(void) {
+	double positive[BENCH_INPUTS], unit[BENCH_INPUTS];
+	int ok, i;
+
+	ok = check_rsqrt();
+	ok &= check_atan2();
+	ok &= check_asin();
+
+	for(i = 0; i < BENCH_INPUTS; i++) {
+		positive[i] = 0.5 + 1.5 * i / BENCH_INPUTS;
+		unit[i] = -0.999 + 1.998 * i / BENCH_INPUTS;
+	}
+
+	printf("%-8s %12s %12s\r\n", "", "libm (ns)", "fast (ns)");
+	printf("%-8s %12.1f %12.1f\r\n", "rsqrt", bench(libm_rsqrt, positive), bench(fast_rsqrt_wrap, positive));
+	printf("%-8s %12.1f %12.1f\r\n", "atan2", bench(libm_atan2, unit), bench(fast_atan2_wrap, unit));
+	printf("%-8s %12.1f %12.1f\r\n", "asin", bench(libm_asin, unit), bench(fast_asin_wrap, unit));
+
+	if(!ok) {
+		printf("An approximation is outside its documented error bound\r\n");
+		exit(1);
+	}
+
+	return 0;
+}
@@ -0,0 +1,89 @@
+#include <math.h>
+#include <string.h>
+
+#include "metrics.h"
+
+void metrics_init(struct step_tracker* m) {
+	memset(m, 0, sizeof(*m));
+}
+
+/*
+ * Start measuring a step from the angle y0 to target, expected to last duration seconds.  Steps
+ * too small to measure are ignored.
+ */
+void metrics_start(struct step_tracker* m, double y0, double target, double duration) {
+	int count = m->count;
+
+	memset(m, 0, sizeof(*m));
+	m->count = count;
+
+	if(fabs(target - y0) < METRICS_MIN_STEP) {
+		return;
+	}
+
+	m->active = 1;
+	m->y0 = y0;
+	m->target = target;
+	m->duration = duration;
+	m->t10 = -1.0;
+	m->t90 = -1.0;
+}
+
+/*
+ * Feed the measured angle after deltat seconds
+ */
+void metrics_update(struct step_tracker* m, double y, double deltat) {
+	double progress, error;
+
+	if(!m->active) {
+		return;
+	}
+
+	m->t += deltat;
+	error = fabs(m->target - y);
+	progress = (y - m->y0) / (m->target - m->y0);
+
+	m->iae += error * deltat;
+	m->itae += m->t * error * deltat;
+
+	if(m->t10 < 0.0 && progress >= 0.1) {
+		m->t10 = m->t;
+	}
+	if(m->t90 < 0.0 && progress >= 0.9) {
+		m->t90 = m->t;
+	}
+	if(progress > m->peak) {
+		m->peak = progress;
+	}
+	if(fabs(1.0 - progress) > METRICS_SETTLE_BAND) {
+		m->settled = m->t;
+	}
+	if(m->t >= m->duration * (1.0 - METRICS_TAIL)) {
+		m->tail_sum += m->target - y;
+		m->tail_count++;
+	}
+}
+
+/*
+ * End the step and fill in its metrics, returns 0 if no step was being measured.  A response that
+ * never got to 90% has a negative rise time and one that never settled a negative settling time.
+ */
+int metrics_finish(struct step_tracker* m, struct step_metrics* out) {
+	if(!m->active) {
+		return 0;
+	}
+
+	m->active = 0;
+	m->count++;
+
+	out->index = m->count;
+	out->amplitude = m->target - m->y0;
+	out->rise = m->t10 >= 0.0 && m->t90 >= 0.0 ? m->t90 - m->t10 : -1.0;
+	out->overshoot = m->peak > 1.0 ? (m->peak - 1.0) * 100.0 : 0.0;
+	out->settling = m->settled < m->t ? m->settled : -1.0;
+	out->error = m->tail_count > 0 ? m->tail_sum / m->tail_count : 0.0;
+	out->iae = m->iae;
+	out->itae = m->itae;
+
+	return 1;
+}
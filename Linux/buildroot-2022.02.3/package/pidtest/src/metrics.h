@@ -0,0 +1,55 @@
+/*
+ * Step response metrics computed online while a profile is played.
+ *
+ * A tracker is started at every step with the measured angle before the step and the new target and
+ * is fed the measured angle on every loop.  When the step ends the figures are worked out from what
+ * was accumulated, nothing is buffered so the cost per loop is constant:
+ *
+ * rise       time to go from 10% to 90% of the step, seconds
+ * overshoot  largest excursion past the target in percent of the step
+ * settling   time after which the response stays within 2% of the step, seconds
+ * error      mean error over the last 20% of the step, degrees
+ * iae, itae  integral of the absolute error and of time times the absolute error
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+static const double METRICS_SETTLE_BAND = 0.02; /* Settling band in fractions of the step */
+static const double METRICS_TAIL = 0.2;         /* Fraction at the end of the step used for the steady state error */
+static const double METRICS_MIN_STEP = 0.5;     /* Smallest step in degrees worth measuring */
+
+struct step_metrics {
+	int index;         /* Number of the step, 0 before the first one finished */
+	double amplitude;
+	double rise;
+	double overshoot;
+	double settling;
+	double error;
+	double iae;
+	double itae;
+};
+
+struct step_tracker {
+	int active;
+	int count;
+	double y0;
+	double target;
+	double duration;
+	double t;
+	double t10;        /* Time the response first passed 10% of the step, negative until then */
+	double t90;
+	double settled;    /* Last time the response was outside the settling band */
+	double peak;       /* Largest progress past the start in fractions of the step */
+	double tail_sum;
+	int tail_count;
+	double iae;
+	double itae;
+};
+
+void metrics_init(struct step_tracker*);
+void metrics_start(struct step_tracker*, double, double, double);
+void metrics_update(struct step_tracker*, double, double);
+int metrics_finish(struct step_tracker*, struct step_metrics*);
+
+#endif
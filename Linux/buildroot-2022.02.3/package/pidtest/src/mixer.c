@@ -0,0 +1,138 @@
+#include <math.h>
+#include <string.h>
+
+#include "gyro.h"
+#include "mixer.h"
+
+/* Motor 1 front right, then clockwise seen from above */
+static const struct mixer_motor QUAD_X_TABLE[] = {
+	{ -1.0,  1.0, -1.0 },
+	{ -1.0, -1.0,  1.0 },
+	{  1.0, -1.0, -1.0 },
+	{  1.0,  1.0,  1.0 }
+};
+
+/* Motor 1 front, then clockwise seen from above */
+static const struct mixer_motor QUAD_PLUS_TABLE[] = {
+	{  0.0,  1.0, -1.0 },
+	{ -1.0,  0.0,  1.0 },
+	{  0.0, -1.0, -1.0 },
+	{  1.0,  0.0,  1.0 }
+};
+
+/* Motor 1 front right (30 degrees), then clockwise seen from above every 60 degrees */
+static const struct mixer_motor HEX_X_TABLE[] = {
+	{ -0.5,  0.866, -1.0 },
+	{ -1.0,  0.0,    1.0 },
+	{ -0.5, -0.866, -1.0 },
+	{  0.5, -0.866,  1.0 },
+	{  1.0,  0.0,   -1.0 },
+	{  0.5,  0.866,  1.0 }
+};
+
+/*
+ * The old get_pid() added kP * (measured - target) to the jig motor while the controller demands
+ * kP * (target - measured), the motor takes the yaw demand negated so a rig tuned on the old build
+ * keeps its polarity
+ */
+static const struct mixer_motor JIG_TABLE[] = {
+	{  0.0,  0.0, -1.0 }
+};
+
+static const struct {
+	const char* name;
+	const struct mixer_motor* table;
+	int motors;
+} LAYOUTS[MIXER_LAYOUT_COUNT] = {
+	[MIXER_QUAD_X] = { "quadx", QUAD_X_TABLE, 4 },
+	[MIXER_QUAD_PLUS] = { "quadplus", QUAD_PLUS_TABLE, 4 },
+	[MIXER_HEX_X] = { "hexx", HEX_X_TABLE, 6 },
+	[MIXER_JIG] = { "jig", JIG_TABLE, 1 }
+};
+
+/*
+ * Look up a layout by the name used on the command line, returns -1 if there is no such layout
+ */
+int mixer_from_name(const char* name) {
+	int i;
+
+	for(i = 0; i < MIXER_LAYOUT_COUNT; i++) {
+		if(strcmp(name, LAYOUTS[i].name) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+const char* mixer_name(enum mixer_layout layout) {
+	return LAYOUTS[layout].name;
+}
+
+/*
+ * Set up the mixer for a layout with the default pulse range
+ */
+void mixer_init(struct mixer* m, enum mixer_layout layout) {
+	m->layout = layout;
+	m->table = LAYOUTS[layout].table;
+	m->motors = LAYOUTS[layout].motors;
+	m->min_us = MIXER_MIN_US;
+	m->max_us = MIXER_MAX_US;
+}
+
+/*
+ * Every motor at the idle pulse, used for arming and stopping
+ */
+void mixer_idle(const struct mixer* m, int* out) {
+	int i;
+
+	for(i = 0; i < m->motors; i++) {
+		out[i] = m->min_us;
+	}
+}
+
+/*
+ * Mix the thrust (pulse width in microseconds) and the demands into out[] (one pulse per motor).
+ *
+ * When the spread between the motors doesn't fit between min_us and max_us the demands are scaled
+ * down until it does.  The thrust is then moved so every motor stays in range, so a motor hitting
+ * its limit costs thrust instead of attitude control.
+ */
+void mixer_mix(const struct mixer* m, double thrust, struct vec3 demand, int* out) {
+	double mix[MIXER_MAX_MOTORS];
+	double lo, hi, range, span, scale;
+	int i;
+
+	lo = 0.0;
+	hi = 0.0;
+	for(i = 0; i < m->motors; i++) {
+		mix[i] = m->table[i].roll * demand.x + m->table[i].pitch * demand.y + m->table[i].yaw * demand.z;
+		if(i == 0 || mix[i] < lo) {
+			lo = mix[i];
+		}
+		if(i == 0 || mix[i] > hi) {
+			hi = mix[i];
+		}
+	}
+
+	span = m->max_us - m->min_us;
+	range = hi - lo;
+	scale = 1.0;
+	if(range > span) {
+		scale = span / range;
+		lo *= scale;
+		hi *= scale;
+	}
+
+	/* Shift the thrust so the lowest and highest motor are both in range */
+	if(thrust + hi > m->max_us) {
+		thrust = m->max_us - hi;
+	}
+	if(thrust + lo < m->min_us) {
+		thrust = m->min_us - lo;
+	}
+
+	for(i = 0; i < m->motors; i++) {
+		out[i] = (int)lround(thrust + mix[i] * scale);
+	}
+}
@@ -0,0 +1,50 @@
+#include "gyro.h"
+
+/*
+ * Motor mixer, turns the thrust and the roll / pitch / yaw demands of the controller into one pulse
+ * width per motor.
+ *
+ * Every layout is a table with the share of each demand for every motor.  For a motor at (x, y) in
+ * the body frame (x forward, y right, z down) the roll share is -y and the pitch share is x, the yaw
+ * share is the sign of the reaction torque of its propeller.  The motors are on consecutive PWM
+ * channels in table order so they can be written in one block.
+ */
+
+#ifndef _MIXER_H
+#define _MIXER_H
+
+#define MIXER_MAX_MOTORS 8
+
+static const int MIXER_MIN_US = 1000; /* Motor stopped / idle pulse */
+static const int MIXER_MAX_US = 2000; /* Full throttle pulse */
+
+enum mixer_layout {
+	MIXER_QUAD_X,
+	MIXER_QUAD_PLUS,
+	MIXER_HEX_X,
+	MIXER_JIG,    /* Single motor on the yaw test jig */
+	MIXER_LAYOUT_COUNT
+};
+
+struct mixer_motor {
+	double roll;
+	double pitch;
+	double yaw;
+};
+
+struct mixer {
+	enum mixer_layout layout;
+	int motors;
+	const struct mixer_motor* table;
+	int min_us;
+	int max_us;
+};
+
+int mixer_from_name(const char*);
+const char* mixer_name(enum mixer_layout);
+
+void mixer_init(struct mixer*, enum mixer_layout);
+void mixer_idle(const struct mixer*, int*);
+void mixer_mix(const struct mixer*, double, struct vec3, int*);
+
+#endif
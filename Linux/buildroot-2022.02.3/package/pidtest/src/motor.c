@@ -0,0 +1,297 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/magic.h>
+
+#include "pwm.h"
+#include "motor.h"
+
+static const char* BACKEND_NAMES[MOTOR_BACKEND_COUNT] = {
+	[MOTOR_PCA9685] = "pca9685",
+	[MOTOR_SYSFS] = "sysfs"
+};
+
+int motor_backend_from_name(const char* name) {
+	int i;
+
+	for(i = 0; i < MOTOR_BACKEND_COUNT; i++) {
+		if(strcmp(name, BACKEND_NAMES[i]) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+const char* motor_backend_name(enum motor_backend backend) {
+	return BACKEND_NAMES[backend];
+}
+
+/*
+ * Refuse a frame rate that doesn't fit the longest pulse of the protocol
+ */
+static void check_protocol(double hz, enum pwm_protocol protocol) {
+	if(hz > pwm_protocol_max_hz(protocol)) {
+		printf("%.0f Hz frames are too fast for %s pulses, at most %.0f Hz\r\n", hz,
+			pwm_protocol_name(protocol), pwm_protocol_max_hz(protocol));
+		exit(1);
+	}
+}
+
+/*
+ * Drive count motors from the PCA9685 on an I2C adapter with frames of hz, trim corrects the
+ * nominal frequency of its oscillator
+ */
+void motor_open_pca9685(struct motor_output* m, int adapter_nr, int count, double hz,
+	enum pwm_protocol protocol, double trim) {
+	if(count > MOTOR_MAX_OUTPUTS) {
+		printf("The PCA9685 backend can drive at most %d motors\r\n", MOTOR_MAX_OUTPUTS);
+		exit(1);
+	}
+	check_protocol(hz, protocol);
+
+	m->backend = MOTOR_PCA9685;
+	m->count = count;
+	setup_pwm(&m->pwm, adapter_nr);
+
+	set_pwm_trim(&m->pwm, trim);
+	set_pwm_protocol(&m->pwm, protocol);
+	m->scale = pwm_protocol_scale(protocol);
+	m->hz = set_pwm_frequency(&m->pwm, hz);
+	m->epoch = get_pwm_epoch(&m->pwm);
+
+	set_all_pwm(&m->pwm, 0, 0);
+}
+
+static double monotonic(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/*
+ * Open a file of a PWM channel, waiting up to MOTOR_EXPORT_TIMEOUT for it to appear or become
+ * writable after the channel was exported
+ */
+static int open_attr(const char* path, int flags) {
+	struct timespec ts;
+	double start;
+	int fd;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = MOTOR_EXPORT_POLL_NS;
+
+	start = monotonic();
+	while((fd = open(path, flags)) < 0 && (errno == ENOENT || errno == EACCES) &&
+		monotonic() - start < MOTOR_EXPORT_TIMEOUT) {
+		nanosleep(&ts, NULL);
+	}
+
+	return fd;
+}
+
+/*
+ * Write a number to a sysfs attribute, returns -1 if it can't be written
+ */
+static int write_attr(const char* path, long value) {
+	char text[32];
+	int fd, len, res;
+
+	fd = open_attr(path, O_WRONLY | O_TRUNC);
+	if(fd < 0) {
+		return -1;
+	}
+
+	len = snprintf(text, sizeof(text), "%ld\n", value);
+	res = write(fd, text, len) == len ? 0 : -1;
+	close(fd);
+
+	return res;
+}
+
+/*
+ * Read a number from a sysfs attribute, returns -1 if it can't be read
+ */
+static long read_attr(const char* path) {
+	FILE* file;
+	long value;
+
+	file = fopen(path, "r");
+	if(file == NULL) {
+		return -1;
+	}
+
+	if(fscanf(file, "%ld", &value) != 1) {
+		value = -1;
+	}
+	fclose(file);
+
+	return value;
+}
+
+/*
+ * Replace the value in an attribute that stays open.  sysfs takes the whole value from every write
+ * at offset 0, a plain file would keep the end of a longer value that was there before.
+ */
+static int rewrite_attr(struct motor_output* m, int fd, const char* text, int len) {
+	if(pwrite(fd, text, len, 0) != len) {
+		return -1;
+	}
+
+	if(m->truncate && ftruncate(fd, len) != 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Drive count motors from channels 0 to count - 1 of the kernel PWM chip in the chip directory
+ */
+void motor_open_sysfs(struct motor_output* m, const char* chip, int count, double hz, enum pwm_protocol protocol) {
+	char path[256];
+	struct stat st;
+	struct statfs fs;
+	long period, channels;
+	int i;
+
+	if(count > MOTOR_MAX_OUTPUTS) {
+		printf("The sysfs backend can drive at most %d motors\r\n", MOTOR_MAX_OUTPUTS);
+		exit(1);
+	}
+	check_protocol(hz, protocol);
+
+	snprintf(path, sizeof(path), "%s/npwm", chip);
+	channels = read_attr(path);
+	if(channels < 0) {
+		printf("Failed to read the number of channels of %s\r\n", chip);
+		exit(1);
+	}
+	if(channels < count) {
+		printf("%s only has %ld PWM channels for %d motors\r\n", chip, channels, count);
+		exit(1);
+	}
+
+	m->backend = MOTOR_SYSFS;
+	m->count = count;
+	m->pwm.file = -1;
+	m->scale = pwm_protocol_scale(protocol);
+	m->truncate = statfs(chip, &fs) == 0 && fs.f_type != SYSFS_MAGIC;
+
+	period = (long)(1000000000.0 / hz + 0.5);
+	m->hz = 1000000000.0 / period;
+
+	for(i = 0; i < count; i++) {
+		snprintf(path, sizeof(path), "%s/pwm%d", chip, i);
+		if(stat(path, &st) != 0) {
+			snprintf(path, sizeof(path), "%s/export", chip);
+			if(write_attr(path, i) != 0) {
+				printf("Failed to export the PWM channel %d of %s\r\n", i, chip);
+				exit(1);
+			}
+		}
+
+		/* The duty cycle has to fit the period at every step so clear it first */
+		snprintf(path, sizeof(path), "%s/pwm%d/duty_cycle", chip, i);
+		if(write_attr(path, 0) != 0) {
+			printf("Failed to clear the duty cycle of PWM channel %d of %s\r\n", i, chip);
+			exit(1);
+		}
+
+		snprintf(path, sizeof(path), "%s/pwm%d/period", chip, i);
+		if(write_attr(path, period) != 0) {
+			printf("Failed to set the period of PWM channel %d of %s\r\n", i, chip);
+			exit(1);
+		}
+
+		snprintf(path, sizeof(path), "%s/pwm%d/duty_cycle", chip, i);
+		m->duty[i] = open_attr(path, O_WRONLY);
+
+		snprintf(path, sizeof(path), "%s/pwm%d/enable", chip, i);
+		m->enable[i] = open_attr(path, O_WRONLY);
+
+		if(m->duty[i] < 0 || m->enable[i] < 0) {
+			printf("Failed to open PWM channel %d of %s\r\n", i, chip);
+			exit(1);
+		}
+	}
+
+	/* The frames of every channel start when it is enabled, close enough to one epoch */
+	m->epoch = monotonic();
+	for(i = 0; i < count; i++) {
+		if(rewrite_attr(m, m->enable[i], "1\n", 2) != 0) {
+			printf("Failed to enable PWM channel %d of %s\r\n", i, chip);
+			exit(1);
+		}
+	}
+}
+
+/*
+ * Set the pulse width in microseconds of every motor
+ */
+void motor_write_us(struct motor_output* m, const int* us) {
+	char text[32];
+	int i, len;
+
+	if(m->backend == MOTOR_PCA9685) {
+		set_pwm_us_block(&m->pwm, 0, us, m->count);
+		return;
+	}
+
+	for(i = 0; i < m->count; i++) {
+		len = snprintf(text, sizeof(text), "%ld\n", (long)(us[i] * m->scale * 1000.0 + 0.5));
+		if(rewrite_attr(m, m->duty[i], text, len) != 0) {
+			printf("Failed to set the duty cycle of PWM channel %d\r\n", i);
+			exit(1);
+		}
+	}
+}
+
+/*
+ * No pulses at all on any output, the ESCs see a lost signal
+ */
+void motor_stop(struct motor_output* m) {
+	int i;
+
+	if(m->backend == MOTOR_PCA9685) {
+		set_all_pwm(&m->pwm, 0, 0);
+		return;
+	}
+
+	for(i = 0; i < m->count; i++) {
+		if(rewrite_attr(m, m->duty[i], "0\n", 2) != 0) {
+			printf("Failed to stop PWM channel %d\r\n", i);
+		}
+	}
+}
+
+/*
+ * Stop and release the outputs
+ */
+void motor_close(struct motor_output* m) {
+	int i;
+
+	motor_stop(m);
+
+	if(m->backend == MOTOR_PCA9685) {
+		close(m->pwm.file);
+		return;
+	}
+
+	for(i = 0; i < m->count; i++) {
+		if(rewrite_attr(m, m->enable[i], "0\n", 2) != 0) {
+			printf("Failed to disable PWM channel %d\r\n", i);
+		}
+		close(m->duty[i]);
+		close(m->enable[i]);
+	}
+}
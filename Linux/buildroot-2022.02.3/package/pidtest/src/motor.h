@@ -0,0 +1,59 @@
+/*
+ * Motor outputs behind one interface so the ESCs can be driven either by the PCA9685 on the I2C bus
+ * (pwm.c) or by the hardware PWM channels of the SoC through the kernel PWM subsystem.
+ *
+ * The sysfs backend takes the writes off the I2C bus that the sensors are on.  Motor n is channel n
+ * of the PWM chip, the channels are exported if they aren't already and every update is one write
+ * of the duty cycle (in nanoseconds, so no rounding to ticks) per motor to a file that stays open.
+ * The chip directory is a parameter so the backend can be pointed at a fake tree of plain files
+ * (make motortest does that):
+ *
+ * <chip>/npwm
+ * <chip>/export
+ * <chip>/pwm<n>/period
+ * <chip>/pwm<n>/duty_cycle
+ * <chip>/pwm<n>/enable
+ *
+ * The pwm<n> directory of a channel that was just exported may show up (or become writable, once
+ * udev has fixed its permissions) a little later, its files are retried for MOTOR_EXPORT_TIMEOUT.
+ */
+
+#include "pwm.h"
+
+#ifndef _MOTOR_H
+#define _MOTOR_H
+
+#define MOTOR_MAX_OUTPUTS 8
+
+static const char MOTOR_SYSFS_CHIP[] = "/sys/class/pwm/pwmchip0";
+static const double MOTOR_EXPORT_TIMEOUT = 1.0; /* Seconds to wait for an exported channel to be usable */
+static const long MOTOR_EXPORT_POLL_NS = 10000000;
+
+enum motor_backend {
+	MOTOR_PCA9685,
+	MOTOR_SYSFS,
+	MOTOR_BACKEND_COUNT
+};
+
+struct motor_output {
+	enum motor_backend backend;
+	int count;
+	double hz;                        /* Frame rate the hardware really runs */
+	double epoch;                     /* Start of a frame on CLOCK_MONOTONIC */
+	double scale;                     /* Applied to the pulse widths for OneShot125 */
+	struct pwm pwm;                   /* PCA9685 device */
+	int duty[MOTOR_MAX_OUTPUTS];      /* Open duty_cycle files of the sysfs channels */
+	int enable[MOTOR_MAX_OUTPUTS];
+	int truncate;                     /* The sysfs files are plain files, cut them after each write */
+};
+
+int motor_backend_from_name(const char*);
+const char* motor_backend_name(enum motor_backend);
+
+void motor_open_pca9685(struct motor_output*, int, int, double, enum pwm_protocol, double);
+void motor_open_sysfs(struct motor_output*, const char*, int, double, enum pwm_protocol);
+void motor_write_us(struct motor_output*, const int*);
+void motor_stop(struct motor_output*);
+void motor_close(struct motor_output*);
+
+#endif
@@ -0,0 +1,226 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "motor.h"
+
+/*
+ * Check of the sysfs motor backend against a fake PWM chip of plain files (make motortest).
+ *
+ * The tree is built in a temporary directory with some channels missing.  Those are only created
+ * by a helper thread a while after the backend writes their number to export, the way udev
+ * finishes an exported channel after the write has returned.  Then the period, the duty cycles
+ * (including a shorter value after a longer one) and the enables are read back, and a chip with
+ * too few channels has to be refused.  The tool exits with an error if anything doesn't match.
+ */
+
+#define TEST_MOTORS 4
+
+static const int TEST_PRESENT = 2;        /* Channels that exist before the backend is opened */
+static const double TEST_HZ = 400.0;
+static const long TEST_EXPORT_DELAY_NS = 50000000; /* Time the fake udev takes to create a channel */
+
+static char chip[64];
+static volatile int exporting;
+
+static void write_file(const char* path, const char* text) {
+	FILE* file;
+
+	file = fopen(path, "w");
+	if(file == NULL || fputs(text, file) < 0 || fclose(file) != 0) {
+		printf("Failed to write %s\r\n", path);
+		exit(1);
+	}
+}
+
+static void read_file(const char* path, char* text, int size) {
+	FILE* file;
+	int len;
+
+	text[0] = '\0';
+	file = fopen(path, "r");
+	if(file == NULL) {
+		return;
+	}
+
+	len = fread(text, 1, size - 1, file);
+	text[len] = '\0';
+	fclose(file);
+}
+
+static void make_channel(int channel) {
+	char path[128];
+
+	snprintf(path, sizeof(path), "%s/pwm%d", chip, channel);
+	mkdir(path, 0755);
+
+	snprintf(path, sizeof(path), "%s/pwm%d/period", chip, channel);
+	write_file(path, "0\n");
+	snprintf(path, sizeof(path), "%s/pwm%d/duty_cycle", chip, channel);
+	write_file(path, "0\n");
+	snprintf(path, sizeof(path), "%s/pwm%d/enable", chip, channel);
+	write_file(path, "0\n");
+}
+
+/*
+ * Stand in for the kernel and udev, create every channel that gets written to export late
+ */
+static void* fake_udev(void* args) {
+	struct timespec ts;
+	char path[128], dir[128], text[32];
+	struct stat st;
+	int channel;
+
+	(void)args;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = 1000000;
+
+	snprintf(path, sizeof(path), "%s/export", chip);
+	while(exporting) {
+		read_file(path, text, sizeof(text));
+		if(sscanf(text, "%d", &channel) == 1) {
+			snprintf(dir, sizeof(dir), "%s/pwm%d", chip, channel);
+			if(stat(dir, &st) != 0) {
+				ts.tv_nsec = TEST_EXPORT_DELAY_NS;
+				nanosleep(&ts, NULL);
+				ts.tv_nsec = 1000000;
+				make_channel(channel);
+			}
+		}
+		nanosleep(&ts, NULL);
+	}
+
+	return NULL;
+}
+
+/*
+ * Copy text with its newlines spelled out, so stale bytes after the first one show up
+ */
+static const char* escape(const char* text, char* out, int size) {
+	int i;
+
+	for(i = 0; *text != '\0' && i < size - 2; text++) {
+		if(*text == '\n') {
+			out[i++] = '\\';
+			out[i++] = 'n';
+		} else {
+			out[i++] = *text;
+		}
+	}
+	out[i] = '\0';
+
+	return out;
+}
+
+/*
+ * Compare an attribute of a channel with what it should hold, returns 1 if it matches
+ */
+static int expect(int channel, const char* attr, const char* value) {
+	char path[128], text[32], got[64], want[64];
+
+	snprintf(path, sizeof(path), "%s/pwm%d/%s", chip, channel, attr);
+	read_file(path, text, sizeof(text));
+
+	if(strcmp(text, value) != 0) {
+		printf("pwm%d/%s holds \"%s\" instead of \"%s\"\r\n", channel, attr,
+			escape(text, got, sizeof(got)), escape(value, want, sizeof(want)));
+		return 0;
+	}
+
+	return 1;
+}
+
+int main(void) {
+	struct motor_output m;
+	pthread_t udev;
+	char path[128], text[32], command[128];
+	int us[TEST_MOTORS];
+	int ok, i, status;
+	pid_t child;
+
+	strcpy(chip, "/tmp/motortest.XXXXXX");
+	if(mkdtemp(chip) == NULL) {
+		printf("Failed to create the fake PWM chip\r\n");
+		exit(1);
+	}
+
+	snprintf(path, sizeof(path), "%s/npwm", chip);
+	snprintf(text, sizeof(text), "%d\n", TEST_MOTORS);
+	write_file(path, text);
+	snprintf(path, sizeof(path), "%s/export", chip);
+	write_file(path, "");
+	for(i = 0; i < TEST_PRESENT; i++) {
+		make_channel(i);
+	}
+
+	exporting = 1;
+	if(pthread_create(&udev, NULL, fake_udev, NULL) != 0) {
+		printf("Creating the fake udev thread failed\r\n");
+		exit(1);
+	}
+
+	motor_open_sysfs(&m, chip, TEST_MOTORS, TEST_HZ, PWM_STANDARD);
+
+	exporting = 0;
+	pthread_join(udev, NULL);
+
+	ok = 1;
+	for(i = 0; i < TEST_MOTORS; i++) {
+		ok &= expect(i, "period", "2500000\n");
+		ok &= expect(i, "enable", "1\n");
+	}
+
+	/* A shorter value has to replace a longer one completely */
+	for(i = 0; i < TEST_MOTORS; i++) {
+		us[i] = 2000;
+	}
+	motor_write_us(&m, us);
+	for(i = 0; i < TEST_MOTORS; i++) {
+		us[i] = 900 + i;
+	}
+	motor_write_us(&m, us);
+	for(i = 0; i < TEST_MOTORS; i++) {
+		snprintf(text, sizeof(text), "%d\n", us[i] * 1000);
+		ok &= expect(i, "duty_cycle", text);
+	}
+
+	motor_close(&m);
+	for(i = 0; i < TEST_MOTORS; i++) {
+		ok &= expect(i, "duty_cycle", "0\n");
+		ok &= expect(i, "enable", "0\n");
+	}
+
+	/* More motors than the chip has channels, the backend exits */
+	fflush(stdout);
+	child = fork();
+	if(child == 0) {
+		freopen("/dev/null", "w", stdout);
+		motor_open_sysfs(&m, chip, TEST_MOTORS + 1, TEST_HZ, PWM_STANDARD);
+		exit(0);
+	}
+	if(waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) == 0) {
+		printf("Opening more motors than the chip has channels did not fail\r\n");
+		ok = 0;
+	}
+
+	snprintf(command, sizeof(command), "rm -rf %s", chip);
+	if(system(command) != 0) {
+		printf("Failed to remove %s\r\n", chip);
+	}
+
+	if(!ok) {
+		printf("The sysfs backend did not drive the fake chip as expected\r\n");
+		exit(1);
+	}
+
+	printf("The sysfs backend drove %d channels of the fake chip, %d of them exported late\r\n",
+		TEST_MOTORS, TEST_MOTORS - TEST_PRESENT);
+
+	return 0;
+}
@@ -0,0 +1,139 @@
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "params.h"
+
+/*
+ * Read the store at path.  A missing file is an empty store, returns -1 only if the file exists
+ * but can't be parsed.
+ */
+int params_load(struct params* p, const char* path) {
+	char line[256], name[PARAM_NAME_MAX];
+	double value;
+	FILE* file;
+	int number;
+
+	memset(p, 0, sizeof(*p));
+	strncpy(p->path, path, sizeof(p->path) - 1);
+
+	file = fopen(path, "r");
+	if(file == NULL) {
+		return 0;
+	}
+
+	number = 0;
+	while(fgets(line, sizeof(line), file) != NULL) {
+		number++;
+		if(line[0] == '#' || line[0] == '\n' || line[0] == '\r') {
+			continue;
+		}
+
+		if(sscanf(line, " %31[^= \t] = %lf", name, &value) != 2) {
+			printf("Invalid line %d in %s\r\n", number, path);
+			fclose(file);
+			return -1;
+		}
+
+		if(params_set(p, name, value) != 0) {
+			fclose(file);
+			return -1;
+		}
+	}
+
+	fclose(file);
+
+	return 0;
+}
+
+/*
+ * Write the store back to the file it was loaded from
+ */
+int params_save(struct params* p) {
+	char tmp[sizeof(p->path) + 4], dir[sizeof(p->path)];
+	FILE* file;
+	int i, fd, res;
+
+	snprintf(tmp, sizeof(tmp), "%s.new", p->path);
+
+	file = fopen(tmp, "w");
+	if(file == NULL) {
+		printf("Failed to open %s for writing\r\n", tmp);
+		return -1;
+	}
+
+	fprintf(file, "# Written by pidtest\n");
+	for(i = 0; i < p->count; i++) {
+		fprintf(file, "%s = %.17g\n", p->entries[i].name, p->entries[i].value); /* Enough digits to read back the same double */
+	}
+
+	/* The data has to be on the storage before the rename can point the name at it */
+	res = fflush(file) != 0 || fsync(fileno(file)) != 0;
+	if(fclose(file) != 0 || res || rename(tmp, p->path) != 0) {
+		printf("Failed to write %s\r\n", p->path);
+		return -1;
+	}
+
+	/* And the rename itself only survives a power loss once the directory is synced */
+	strcpy(dir, p->path);
+	fd = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+	if(fd < 0 || fsync(fd) != 0) {
+		printf("Failed to sync the directory of %s\r\n", p->path);
+		if(fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	close(fd);
+
+	return 0;
+}
+
+static struct param* params_find(struct params* p, const char* name) {
+	int i;
+
+	for(i = 0; i < p->count; i++) {
+		if(strcmp(p->entries[i].name, name) == 0) {
+			return &p->entries[i];
+		}
+	}
+
+	return NULL;
+}
+
+int params_has(struct params* p, const char* name) {
+	return params_find(p, name) != NULL;
+}
+
+/*
+ * Value of a parameter, or fallback if it isn't in the store
+ */
+double params_get(struct params* p, const char* name, double fallback) {
+	struct param* entry = params_find(p, name);
+
+	return entry != NULL ? entry->value : fallback;
+}
+
+/*
+ * Add or change a parameter, returns -1 if the name is too long or the store is full
+ */
+int params_set(struct params* p, const char* name, double value) {
+	struct param* entry = params_find(p, name);
+
+	if(entry == NULL) {
+		if(strlen(name) >= PARAM_NAME_MAX || p->count >= PARAMS_MAX) {
+			printf("No room for the parameter %s\r\n", name);
+			return -1;
+		}
+
+		entry = &p->entries[p->count++];
+		strcpy(entry->name, name);
+	}
+
+	entry->value = value;
+
+	return 0;
+}
@@ -0,0 +1,36 @@
+/*
+ * Persistent parameter store.
+ *
+ * Parameters are named doubles kept in a text file with one "name = value" line each, lines
+ * starting with # are comments.  The file is rewritten as a whole through a temporary file that is
+ * synced before it replaces the old one, and the directory is synced after, so a crash or power
+ * loss while saving leaves either the old or the new file.  Saving blocks on the storage, never
+ * call it from the real time loop.
+ */
+
+#ifndef _PARAMS_H
+#define _PARAMS_H
+
+#define PARAMS_MAX 64
+#define PARAM_NAME_MAX 32
+
+static const char PARAMS_PATH[] = "/etc/pidtest.conf"; /* Default location of the store */
+
+struct param {
+	char name[PARAM_NAME_MAX];
+	double value;
+};
+
+struct params {
+	char path[256];
+	int count;
+	struct param entries[PARAMS_MAX];
+};
+
+int params_load(struct params*, const char*);
+int params_save(struct params*);
+int params_has(struct params*, const char*);
+double params_get(struct params*, const char*, double);
+int params_set(struct params*, const char*, double);
+
+#endif
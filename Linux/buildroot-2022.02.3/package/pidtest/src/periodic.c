@@ -0,0 +1,130 @@
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "periodic.h"
+
+static const long long NSEC = 1000000000LL;
+
+static const char* POLICY_NAMES[OVERRUN_POLICY_COUNT] = {
+	[OVERRUN_SKIP] = "skip",
+	[OVERRUN_CATCHUP] = "catchup"
+};
+
+int overrun_policy_from_name(const char* name) {
+	int i;
+
+	for(i = 0; i < OVERRUN_POLICY_COUNT; i++) {
+		if(strcmp(name, POLICY_NAMES[i]) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+const char* overrun_policy_name(enum overrun_policy policy) {
+	return POLICY_NAMES[policy];
+}
+
+static long long monotonic_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NSEC + ts.tv_nsec;
+}
+
+/*
+ * Release a cycle every period seconds at the times that are phase seconds past a multiple of the
+ * period on CLOCK_MONOTONIC, so anything else that knows the phase (e.g. the PWM frames) can be
+ * lined up with the cycles.  The first release is the next one in the future.
+ */
+void periodic_init(struct periodic* p, double period, double phase, enum overrun_policy policy) {
+	long long now, offset;
+
+	p->period = (long long)(period * NSEC + 0.5);
+	p->policy = policy;
+	p->cycles = 0;
+	p->overruns = 0;
+	p->skipped = 0;
+	p->misses = 0;
+	histogram_init(&p->jitter, 0.0, PERIODIC_JITTER_RANGE);
+	histogram_init(&p->exec, 0.0, period);
+
+	offset = (long long)(fmod(phase, period) * NSEC);
+	if(offset < 0) {
+		offset += p->period;
+	}
+
+	now = monotonic_ns();
+	p->next = now - (now % p->period) + offset;
+	while(p->next <= now) {
+		p->next += p->period;
+	}
+	p->release = p->next - p->period;
+}
+
+/*
+ * Sleep until the next release, returns the number of releases that were skipped since the last
+ * call (0 when the loop is on time or catching up)
+ */
+int periodic_wait(struct periodic* p) {
+	struct timespec ts;
+	long long now, late, missed;
+
+	now = monotonic_ns();
+	missed = 0;
+
+	if(now > p->next) {
+		p->overruns++;
+		late = (now - p->next) / p->period + 1; /* Releases at or before now */
+
+		if(p->policy == OVERRUN_SKIP || late > PERIODIC_MAX_CATCHUP) {
+			missed = late;
+			p->next += missed * p->period;
+			p->skipped += missed;
+		}
+	}
+
+	if(p->next > now) {
+		ts.tv_sec = p->next / NSEC;
+		ts.tv_nsec = p->next % NSEC;
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+	}
+
+	p->release = p->next;
+	p->next += p->period;
+	p->cycles++;
+
+	p->start = monotonic_ns();
+	histogram_add(&p->jitter, (double)(p->start - p->release) / NSEC);
+
+	return (int)missed;
+}
+
+/*
+ * Mark the end of the work of the current cycle
+ */
+void periodic_done(struct periodic* p) {
+	long long now;
+
+	now = monotonic_ns();
+	histogram_add(&p->exec, (double)(now - p->start) / NSEC);
+
+	if(now > p->next) {
+		p->misses++;
+	}
+}
+
+/*
+ * Release time of the current cycle in seconds on CLOCK_MONOTONIC
+ */
+double periodic_release(struct periodic* p) {
+	return (double)p->release / NSEC;
+}
+
+double periodic_period(struct periodic* p) {
+	return (double)p->period / NSEC;
+}
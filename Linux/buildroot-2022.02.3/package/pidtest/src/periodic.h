@@ -0,0 +1,58 @@
+#include <time.h>
+
+#include "histogram.h"
+
+/*
+ * Fixed rate release of the real time loop.
+ *
+ * Cycles are released at absolute times on CLOCK_MONOTONIC, phase + k * period, and the thread
+ * sleeps until the next release with clock_nanosleep(TIMER_ABSTIME) so the time the work took
+ * doesn't move the schedule.  A cycle that ends after the next release is an overrun, what happens
+ * to the releases it missed depends on the policy:
+ *
+ * skip     drop them and wait for the first release after now, the phase is kept
+ * catchup  run them back to back without sleeping until the loop is on time again
+ *
+ * Every cycle also records how late it woke up after its release (jitter) and how long its work
+ * took from the wake up until periodic_done(), and counts a deadline miss when the work ended
+ * after the next release.  Nothing may sleep between the two on purpose or the work time is
+ * meaningless.  The histograms are plain structs filled by the loop thread only, they are copied out
+ * with the rest of the telemetry.
+ */
+
+#ifndef _PERIODIC_H
+#define _PERIODIC_H
+
+static const int PERIODIC_MAX_CATCHUP = 10;      /* Missed releases run by catchup before it gives up and skips */
+static const double PERIODIC_JITTER_RANGE = 0.0002; /* Wake up lateness covered by the jitter bins, about 3 us each */
+
+enum overrun_policy {
+	OVERRUN_SKIP,
+	OVERRUN_CATCHUP,
+	OVERRUN_POLICY_COUNT
+};
+
+struct periodic {
+	long long period;  /* Nanoseconds */
+	long long next;    /* Release of the next cycle in nanoseconds on CLOCK_MONOTONIC */
+	long long release; /* Release of the current cycle */
+	enum overrun_policy policy;
+	unsigned long cycles;
+	unsigned long overruns; /* Cycles that could only start after their release */
+	unsigned long skipped;  /* Releases dropped */
+	unsigned long misses;   /* Cycles whose work ended after the next release */
+	long long start;        /* Wake up of the current cycle */
+	struct histogram jitter; /* Wake up minus release, seconds */
+	struct histogram exec;   /* Wake up to periodic_done(), seconds */
+};
+
+int overrun_policy_from_name(const char*);
+const char* overrun_policy_name(enum overrun_policy);
+
+void periodic_init(struct periodic*, double, double, enum overrun_policy);
+int periodic_wait(struct periodic*);
+void periodic_done(struct periodic*);
+double periodic_release(struct periodic*);
+double periodic_period(struct periodic*);
+
+#endif
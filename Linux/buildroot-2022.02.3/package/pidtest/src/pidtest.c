@@ -12,54 +12,409 @@
 #include <sys/mman.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 
 #include "gyro.h"
-#include "madgwick.h"
+#include "quaternion.h"
+#include "estimator.h"
+#include "predictor.h"
+#include "filter.h"
+#include "control.h"
+#include "spectrum.h"
+#include "autotune.h"
+#include "params.h"
+#include "schedule.h"
+#include "profile.h"
+#include "metrics.h"
+#include "histogram.h"
+#include "framesync.h"
+#include "rates.h"
+#include "periodic.h"
+#include "triplebuf.h"
+#include "spsc.h"
+#include "mixer.h"
 #include "pwm.h"
+#include "motor.h"
 
 static const int ADAPTER_NUMBER = 1;
 static const int RT_THREAD_STACK_SIZE = PTHREAD_STACK_MIN * 4;
+static const double PWM_FREQUENCY = 50.0; /* Default ESC frame rate, -w goes up to about 1500 Hz */
+static const double LOOP_RATE = 1000.0; /* Default control loop rate in Hz */
+static const double LOOP_LEAD = 0.0008;  /* Expected sensor to motor write time, the loop is released this far ahead of a PWM frame */
+static const int SCHEDULE_POLL = 200;   /* Telemetry messages between checks of the gain schedule file */
+
+#define PIPELINE_RING_SIZE 16 /* Messages queued between two stages of the pipelined loop */
+
+enum pipeline_stage {
+	PIPELINE_ACQUIRE,
+	PIPELINE_ESTIMATE,
+	PIPELINE_CONTROL,
+	PIPELINE_STAGES
+};
 
 struct rt_transfer {
-	struct vec3 dir;
+	struct quaternion q;      /* Estimated attitude */
 	double elapsed;
+	double latency;           /* Horizon the controller predicts the attitude over */
 	int throttle;
+	struct vec3 setpoint;     /* Attitude the controller is asked to hold, degrees */
+	struct step_metrics step; /* Metrics of the last step of the profile */
+	struct histogram output;  /* Sensor sample to the modelled PWM frame boundary, an estimate */
+	struct histogram pipeline; /* Sensor sample to the start of the control stage */
+};
+
+/*
+ * Published by whichever thread releases the loop cycles, the acquisition stage when pipelined
+ */
+struct rt_timing {
+	struct histogram jitter;  /* Wake up of the loop after its release */
+	struct histogram exec;    /* Work of one loop cycle */
+	unsigned long misses;     /* Cycles that ended after the next release */
+	unsigned long overruns;
 };
 
 struct rt_init {
+	enum estimator_type estimator;
+	enum mixer_layout layout;
+	double loop_hz;         /* Rate the loop is released at, the filters are designed for it */
+	enum overrun_policy overrun;
+	struct rate_plan rates; /* Loop ticks between runs of everything but the rate loop */
+	enum motor_backend backend;
+	const char* pwm_chip; /* Kernel PWM chip directory for the sysfs backend */
+	double pwm_hz;      /* ESC frame rate */
+	enum pwm_protocol protocol; /* Pulse encoding for the ESCs */
+	double notch_hz;    /* Centre of the gyroscope notch filter in Hz, 0 for none */
+	struct spectrum* spectrum; /* Analyser for the dynamic notches, NULL when they are off */
+	struct params* params;     /* Stored gains */
+	int stored_gains;          /* Take the gains from the store instead of asking for them */
+	int autotune;              /* Run the relay experiment first and store the gains it finds, the loop only reads it */
+	enum autotune_rule rule;
+	struct schedule_slot* schedule; /* Throttle indexed rate loop gains, empty for fixed gains */
+	struct profile* profile;        /* Setpoints to play, NULL to hold level */
 	sem_t* kill_sig;
-	pthread_mutex_t* trans_mutex;
-	struct rt_transfer* transfer;
+	sem_t* tuned_sig;             /* Posted by the loop once the autotune has found gains */
+	int tuned;                    /* The fields below are valid, only read after tuned_sig */
+	double tuned_ku;
+	double tuned_tu;
+	struct pid_gains tuned_gains;
+	struct triple_buffer* handoff; /* Latest struct rt_transfer for the telemetry */
+	struct triple_buffer* timing;  /* Latest struct rt_timing */
+	int pipelined;                 /* Run the stages on their own threads */
+	int cores[PIPELINE_STAGES];    /* CPU of each stage when pipelined */
+};
+
+/*
+ * A sample of the sensors from the acquisition stage
+ */
+struct acq_msg {
+	unsigned long tick;
+	double sampled; /* frame_sync_clock() when the gyroscope was read */
+	double elapsed; /* Since the previous sample */
+	struct vec3 w;
+	struct vec3 a;
+	struct vec3 m;
+	int has_a;
+	int has_m;
 };
 
-pthread_t create_rt_thread(void*(*)(void*), struct rt_init*);
+/*
+ * The attitude from the estimation stage
+ */
+struct est_msg {
+	unsigned long tick;
+	double sampled;
+	double elapsed;
+	struct vec3 w;        /* Raw gyroscope rates, degrees per second */
+	struct vec3 unbiased; /* The same with the estimated bias taken out */
+	struct quaternion q;
+};
+
+/*
+ * Everything the stages of the loop keep between cycles.  Each group is only touched by its own
+ * stage so that the stages can run on different threads.
+ */
+struct rt_state {
+	struct rt_init* init;
+	atomic_int stop; /* Ends the stage threads */
+
+	/* Acquisition */
+	int gyro;
+	int mag;
+	struct periodic cycle;
+	struct pt1_filter accel_lpf;
+	struct median3_filter mag_median;
+	double last_sample;
+	unsigned long tick;
+
+	/* Estimation */
+	struct estimator est;
+
+	/* Control and output */
+	struct frame_sync sync;
+	struct predictor pred;
+	struct controller ctrl;
+	struct pid_gains angle_gains;
+	struct pid_gains rate_gains;
+	struct mixer mix;
+	struct motor_output out;
+	int motors[MIXER_MAX_MOTORS];
+	int base_throttle;
+	struct biquad_filter gyro_lpf;
+	struct biquad_filter gyro_notch;
+	struct biquad_filter dynamic_notch[SPECTRUM_NOTCHES];
+	struct autotune tune;
+	int tuning;               /* The relay experiment is driving the jig, cleared once it found gains */
+	struct profile_player player;
+	struct step_tracker tracker;
+	struct step_metrics step;
+	struct quaternion target;
+	struct vec3 target_euler; /* Setpoint target was converted from */
+	int step_axis;
+	double angle_elapsed;
+	struct histogram pipeline;
+
+	/* Between the stages when pipelined */
+	struct spsc_ring acq_ring;
+	struct spsc_ring est_ring;
+	struct acq_msg acq_slots[PIPELINE_RING_SIZE];
+	struct est_msg est_slots[PIPELINE_RING_SIZE];
+};
+
+pthread_t create_rt_thread(void*(*)(void*), void*, int);
 void* rt(void*);
-int get_pid(struct vec3, double, double, double, double);
+void set_axis_gains(struct controller*, struct pid_gains, struct params*);
+void* save_tuned_gains(void*);
 
-int main(void) {
-	int res, pulse, pwm;
+int main(int argc, char** argv) {
+	int res, pulse, pwm, opt;
 	pthread_t rt_thread;
 	struct rt_init init;
 	sem_t kill_sig;
-	pthread_mutex_t trans_mutex;
-	struct rt_transfer transfer;
+	sem_t tuned_sig;
+	pthread_t saver_thread;
+	struct triple_buffer handoff;
+	struct rt_transfer transfer[3];
+	struct rt_transfer* snapshot;
+	struct triple_buffer timing_handoff;
+	struct rt_timing timing[3];
+	struct rt_timing* times;
+	struct vec3 dir;
+	struct spectrum spectrum;
+	struct spectrum_result notches;
+	int dynamic_notch;
+	struct params params;
+	const char* params_path;
+	struct schedule_slot schedule;
+	struct gain_schedule* table;
+	const char* schedule_path;
+	struct stat schedule_stat;
+	time_t schedule_mtime;
+	int polls;
+	struct profile profile;
+	int last_step;
 
 	int socket_desc, client_sock, client_size;
 	struct sockaddr_in server_addr, client_addr;
-	char server_message[128];
+	char server_message[1024];
 	
 	printf("Quadcopter Hardware Test Program v0.0...\r\n");
+
+	init.estimator = ESTIMATOR_MADGWICK;
+	init.layout = MIXER_JIG;
+	init.loop_hz = LOOP_RATE;
+	init.overrun = OVERRUN_SKIP;
+	rate_plan_init(&init.rates);
+	init.backend = MOTOR_PCA9685;
+	init.pwm_chip = MOTOR_SYSFS_CHIP;
+	init.pwm_hz = PWM_FREQUENCY;
+	init.protocol = PWM_STANDARD;
+	init.notch_hz = 0.0;
+	init.spectrum = NULL;
+	init.params = &params;
+	init.stored_gains = 0;
+	init.autotune = 0;
+	params_path = PARAMS_PATH;
+	schedule_path = NULL;
+	schedule_mtime = 0;
+	init.schedule = &schedule;
+	init.profile = NULL;
+	init.pipelined = 0;
+	last_step = 0;
+	schedule_slot_init(&schedule);
+	dynamic_notch = 0;
+	memset(&notches, 0, sizeof(notches));
+
+	while((opt = getopt(argc, argv, "e:l:r:O:j:f:a:m:o:T:n:dt:p:gs:P:w:E:b:c:")) != -1) {
+		switch(opt) {
+		case 'e': /* Attitude estimator to use */
+			res = estimator_from_name(optarg);
+			if(res < 0) {
+				printf("Unknown estimator \"%s\", use madgwick, mahony or ekf\r\n", optarg);
+				exit(1);
+			}
+			init.estimator = res;
+			break;
+		case 'l': /* Motor layout */
+			res = mixer_from_name(optarg);
+			if(res < 0) {
+				printf("Unknown motor layout \"%s\", use quadx, quadplus, hexx or jig\r\n", optarg);
+				exit(1);
+			}
+			init.layout = res;
+			break;
+		case 'r': /* Loop rate in Hz */
+			init.loop_hz = atof(optarg);
+			break;
+		case 'O': /* What to do with the cycles an overrun missed */
+			res = overrun_policy_from_name(optarg);
+			if(res < 0) {
+				printf("Unknown overrun policy \"%s\", use skip or catchup\r\n", optarg);
+				exit(1);
+			}
+			init.overrun = res;
+			break;
+		case 'j': /* Pipeline the loop over three cores, acquisition,estimation,control */
+			if(sscanf(optarg, "%d,%d,%d", &init.cores[PIPELINE_ACQUIRE], &init.cores[PIPELINE_ESTIMATE],
+				&init.cores[PIPELINE_CONTROL]) != PIPELINE_STAGES) {
+				printf("Give the pipeline cores as acquisition,estimation,control\r\n");
+				exit(1);
+			}
+			init.pipelined = 1;
+			break;
+		case 'f': /* Run the estimator correction every n loops */
+			init.rates.divisor[TASK_FUSION] = atoi(optarg);
+			break;
+		case 'a': /* Read the accelerometer every n loops */
+			init.rates.divisor[TASK_ACCEL] = atoi(optarg);
+			break;
+		case 'm': /* Read the magnetometer every n loops */
+			init.rates.divisor[TASK_MAG] = atoi(optarg);
+			break;
+		case 'o': /* Run the angle loop every n loops */
+			init.rates.divisor[TASK_ANGLE] = atoi(optarg);
+			break;
+		case 'T': /* Publish the telemetry every n loops */
+			init.rates.divisor[TASK_TELEMETRY] = atoi(optarg);
+			break;
+		case 'n': /* Notch out a frequency (e.g. the frame resonance) from the gyroscope */
+			init.notch_hz = atof(optarg);
+			break;
+		case 'd': /* Track the motor noise with notches tuned by the spectrum analyser */
+			dynamic_notch = 1;
+			break;
+		case 't': /* Autotune the rate loop with the given rule */
+			res = autotune_rule_from_name(optarg);
+			if(res < 0) {
+				printf("Unknown tuning rule \"%s\", use zn, tl, some or none\r\n", optarg);
+				exit(1);
+			}
+			init.autotune = 1;
+			init.rule = res;
+			break;
+		case 'p': /* Parameter store */
+			params_path = optarg;
+			break;
+		case 'g': /* Fly with the stored gains */
+			init.stored_gains = 1;
+			break;
+		case 's': /* Gain schedule, reloaded when the file changes */
+			schedule_path = optarg;
+			break;
+		case 'P': /* Setpoint profile, built in (steps, ramp, chirp) or a file */
+			if(profile_load(&profile, optarg) != 0) {
+				exit(1);
+			}
+			init.profile = &profile;
+			break;
+		case 'w': /* ESC frame rate in Hz, above PWM_MAX_STANDARD_HZ needs -E oneshot125 */
+			init.pwm_hz = atof(optarg);
+			break;
+		case 'E': /* ESC pulse protocol */
+			res = pwm_protocol_from_name(optarg);
+			if(res < 0) {
+				printf("Unknown ESC protocol \"%s\", use standard or oneshot125\r\n", optarg);
+				exit(1);
+			}
+			init.protocol = res;
+			break;
+		case 'b': /* Motor output backend */
+			res = motor_backend_from_name(optarg);
+			if(res < 0) {
+				printf("Unknown motor output \"%s\", use pca9685 or sysfs\r\n", optarg);
+				exit(1);
+			}
+			init.backend = res;
+			break;
+		case 'c': /* PWM chip directory of the sysfs backend */
+			init.pwm_chip = optarg;
+			break;
+		default:
+			printf("Usage: %s [-e madgwick|mahony|ekf] [-l quadx|quadplus|hexx|jig] [-r loop Hz] [-O skip|catchup] [-j acq,est,ctl cores] [-f fusion divisor] [-a accel divisor] [-m mag divisor] [-o angle loop divisor] [-T telemetry divisor] [-n gyro notch Hz] [-d] [-t zn|tl|some|none] [-p params file] [-g] [-s gain schedule] [-P setpoint profile] [-w pwm Hz] [-E standard|oneshot125] [-b pca9685|sysfs] [-c pwm chip directory]\r\n", argv[0]);
+			exit(1);
+		}
+	}
+
+	if(params_load(&params, params_path) != 0) {
+		printf("Failed to load the parameters from %s\r\n", params_path);
+		exit(1);
+	}
+
+	if(init.stored_gains && !(params_has(&params, "rate_kp") && params_has(&params, "rate_ki") && params_has(&params, "rate_kd"))) {
+		printf("There are no stored gains in %s, run the autotune first\r\n", params_path);
+		exit(1);
+	}
+
+	if(schedule_path != NULL) {
+		table = schedule_load(schedule_path);
+		if(table == NULL || stat(schedule_path, &schedule_stat) != 0) {
+			exit(1);
+		}
+		schedule_publish(&schedule, table);
+		schedule_mtime = schedule_stat.st_mtime;
+		printf("Scheduling the rate loop gains over %d throttle points\r\n", table->points);
+	}
+
+	for(res = 0; res < TASK_COUNT; res++) {
+		if(init.rates.divisor[res] < 1) {
+			printf("The rate divisors must be at least 1\r\n");
+			exit(1);
+		}
+	}
+	rate_plan_stagger(&init.rates);
+
+	if(init.loop_hz <= 0.0) {
+		printf("The loop rate must be positive\r\n");
+		exit(1);
+	}
 	
 	sem_init(&kill_sig, 0, 0);
-	pthread_mutex_init(&trans_mutex, NULL);
 
 	init.kill_sig = &kill_sig;
-	init.trans_mutex = &trans_mutex;
-	init.transfer = &transfer;
+	init.tuned_sig = &tuned_sig;
+	init.tuned = 0;
+	init.handoff = &handoff;
+	triple_buffer_init(&handoff, transfer, sizeof(struct rt_transfer));
+	init.timing = &timing_handoff;
+	triple_buffer_init(&timing_handoff, timing, sizeof(struct rt_timing));
+
+	if(dynamic_notch) {
+		spectrum_init(&spectrum, init.loop_hz, 1);
+		spectrum_start(&spectrum);
+		init.spectrum = &spectrum;
+	}
 
-	rt_thread = create_rt_thread(rt, &init);
+	/* Saving the tuned gains blocks on the file system, it is done here and not on the loop */
+	if(init.autotune) {
+		sem_init(&tuned_sig, 0, 0);
+		if(pthread_create(&saver_thread, NULL, save_tuned_gains, &init) != 0) {
+			printf("Creating the thread that stores the tuned gains failed\r\n");
+			exit(1);
+		}
+	}
+
+	rt_thread = create_rt_thread(rt, &init, init.pipelined ? init.cores[PIPELINE_CONTROL] : -1);
 
 	res = pthread_tryjoin_np(rt_thread, NULL); /* was pthread_tryjoin_np */
 	
@@ -97,15 +452,58 @@ int main(void) {
 
 	printf("Successfully accepted a client with throttle data!\r\n");
 
+	polls = 0;
 	while(1) {
-		//printf("Sending data over the network\r\n");
-		if(pthread_mutex_lock(&trans_mutex) == 0) {
-			sprintf(server_message, 
-				"{ \"type\": \"heading\", \"x\": %f, \"y\": %f, \"z\": %f, \"throttle\": %d, \"elapsed\": %f }\0",
-				transfer.dir.x, transfer.dir.y, transfer.dir.z, transfer.throttle, transfer.elapsed);
-			pthread_mutex_unlock(&trans_mutex);
+		/* Pick up edits of the gain schedule while running */
+		if(schedule_path != NULL && ++polls >= SCHEDULE_POLL) {
+			polls = 0;
+			if(stat(schedule_path, &schedule_stat) == 0 && schedule_stat.st_mtime != schedule_mtime) {
+				schedule_mtime = schedule_stat.st_mtime;
+				table = schedule_load(schedule_path);
+				if(table != NULL) {
+					schedule_publish(&schedule, table);
+					printf("Reloaded the gain schedule\r\n");
+				}
+			}
 		}
 
+		/* Never blocks the real time thread, this is just the latest state it published */
+		triple_buffer_read(&handoff, (void**)&snapshot);
+		triple_buffer_read(&timing_handoff, (void**)&times);
+
+		if(dynamic_notch) {
+			spectrum_fetch(&spectrum, &notches);
+		}
+
+		if(snapshot->step.index != last_step) {
+			last_step = snapshot->step.index;
+			printf("Step %d of %.1f deg: rise %.3f s overshoot %.1f%% settling %.3f s error %.2f deg IAE %.3f ITAE %.3f\r\n",
+				snapshot->step.index, snapshot->step.amplitude, snapshot->step.rise, snapshot->step.overshoot,
+				snapshot->step.settling, snapshot->step.error, snapshot->step.iae, snapshot->step.itae);
+		}
+
+		/* Euler angles are only needed for display so convert them here, off the real time thread */
+		dir = quat_to_euler(snapshot->q);
+		snprintf(server_message, sizeof(server_message),
+			"{ \"type\": \"heading\", \"x\": %f, \"y\": %f, \"z\": %f, \"throttle\": %d, \"elapsed\": %f, \"latency\": %f, \"notch\": [%.1f, %.1f], \"analyser_cpu\": %.3f, "
+			"\"modelled_output_latency\": [%.2f, %.2f, %.2f], \"pipeline_latency\": [%.1f, %.1f, %.1f], "
+			"\"jitter\": [%.1f, %.1f, %.1f], \"exec\": [%.1f, %.1f, %.1f], \"deadline_misses\": %lu, \"overruns\": %lu, \"setpoint\": [%.2f, %.2f, %.2f], \"step\": { \"index\": %d, \"rise\": %.3f, \"overshoot\": %.1f, "
+			"\"settling\": %.3f, \"error\": %.2f, \"iae\": %.3f, \"itae\": %.3f } }",
+			dir.x, dir.y, dir.z, snapshot->throttle, snapshot->elapsed, snapshot->latency,
+			notches.frequency[0], notches.frequency[1], notches.cpu_load,
+			histogram_percentile(&snapshot->output, 0.5) * 1000.0, histogram_percentile(&snapshot->output, 0.99) * 1000.0,
+			snapshot->output.count > 0 ? snapshot->output.max * 1000.0 : 0.0,
+			histogram_percentile(&snapshot->pipeline, 0.5) * 1000000.0, histogram_percentile(&snapshot->pipeline, 0.99) * 1000000.0,
+			snapshot->pipeline.count > 0 ? snapshot->pipeline.max * 1000000.0 : 0.0,
+			histogram_percentile(&times->jitter, 0.5) * 1000000.0, histogram_percentile(&times->jitter, 0.99) * 1000000.0,
+			times->jitter.count > 0 ? times->jitter.max * 1000000.0 : 0.0,
+			histogram_percentile(&times->exec, 0.5) * 1000000.0, histogram_percentile(&times->exec, 0.99) * 1000000.0,
+			times->exec.count > 0 ? times->exec.max * 1000000.0 : 0.0,
+			times->misses, times->overruns,
+			snapshot->setpoint.x, snapshot->setpoint.y, snapshot->setpoint.z,
+			snapshot->step.index, snapshot->step.rise, snapshot->step.overshoot,
+			snapshot->step.settling, snapshot->step.error, snapshot->step.iae, snapshot->step.itae);
+
 		if(send(client_sock, server_message, strlen(server_message), 0) < 0) {
 			printf("Can't send\r\n");
 			goto out;
@@ -135,29 +533,295 @@ out:
 	
 	sleep(1);
 
+	if(init.autotune) {
+		sem_post(&tuned_sig); /* Releases the saver if the autotune never finished */
+		pthread_join(saver_thread, NULL);
+		sem_destroy(&tuned_sig);
+	}
+
+	if(dynamic_notch) {
+		spectrum_stop(&spectrum);
+	}
+
 	printf("Successfully tested the hardware!\r\n");
 }
 
+/*
+ * Acquisition stage: wait for the release of the next cycle and read the sensors that are due
+ */
+static void acquire(struct rt_state* s, struct acq_msg* m) {
+	struct rt_init* init = s->init;
+
+	periodic_wait(&s->cycle);
+
+	m->tick = s->tick++;
+	m->sampled = frame_sync_clock();
+	m->elapsed = m->sampled - s->last_sample;
+	s->last_sample = m->sampled;
+
+	/*
+	 * The gyroscope drives the loop, the other sensors are only read at their own (lower) rates
+	 * so the loop rate can go up without paying for them every time.
+	 */
+	m->w = get_gyro_rates(s->gyro);
+
+	m->has_a = rate_due(&init->rates, TASK_ACCEL, m->tick);
+	if(m->has_a) {
+		m->a = pt1_apply(&s->accel_lpf, get_accel_state(s->gyro));
+	}
+
+	m->has_m = rate_due(&init->rates, TASK_MAG, m->tick);
+	if(m->has_m) {
+		m->m = median3_apply(&s->mag_median, get_mag_state(s->mag));
+	}
+}
+
+/*
+ * Estimation stage: fold a sample into the attitude
+ */
+static void estimate(struct rt_state* s, const struct acq_msg* a, struct est_msg* e) {
+	if(a->has_a) {
+		estimator_add_accel(&s->est, a->a);
+	}
+	if(a->has_m) {
+		estimator_add_mag(&s->est, a->m);
+	}
+
+	e->q = estimator_propagate(&s->est, a->w, a->elapsed);
+
+	if(rate_due(&s->init->rates, TASK_FUSION, a->tick)) {
+		e->q = estimator_fuse(&s->est);
+	}
+
+	e->tick = a->tick;
+	e->sampled = a->sampled;
+	e->elapsed = a->elapsed;
+	e->w = a->w;
+	e->unbiased = estimator_rates(&s->est, a->w);
+}
+
+/*
+ * Control stage: run the controller on an attitude, write the motors and publish the telemetry.
+ * Returns 0 when the loop has to stop.
+ */
+static int control(struct rt_state* s, const struct est_msg* e) {
+	struct rt_init* init = s->init;
+	struct spectrum_result notches;
+	const struct profile_segment* segment;
+	struct rt_transfer* transfer;
+	struct vec3 rates, demand;
+	struct quaternion q;
+	double measured, written;
+	int num, due, angle_due;
+
+	histogram_add(&s->pipeline, frame_sync_clock() - e->sampled);
+
+	/*
+	 * Only the last cycle before a PWM frame writes.  The releases are already lined up LOOP_LEAD
+	 * ahead of the frames, so the cycle is never held back on top of the release.
+	 */
+	due = frame_sync_due(&s->sync, e->sampled);
+
+	/* Act on where the attitude will be when the new pulse goes out, not where it was sampled */
+	q = predict_attitude(&s->pred, e->q, e->unbiased);
+
+	/*
+	 * The outer loop and the setpoints only run every few ticks, the rate loop keeps following
+	 * the last rate setpoint in between.  The angle of an axis is measured from the error against
+	 * the setpoint, which stays small, instead of converting the attitude to Euler angles on this
+	 * thread.
+	 */
+	s->angle_elapsed += e->elapsed;
+	angle_due = rate_due(&init->rates, TASK_ANGLE, e->tick);
+	if(angle_due && init->profile != NULL && !s->tuning) {
+		if(profile_update(&s->player, s->angle_elapsed)) {
+			metrics_finish(&s->tracker, &s->step);
+
+			segment = profile_segment(&s->player);
+			if(segment != NULL && segment->type == SEGMENT_STEP) {
+				/* Start from where the axis was before the setpoint moved */
+				s->step_axis = segment->axis;
+				measured = s->player.start + profile_axis(quat_error(q, s->target), s->step_axis);
+				metrics_start(&s->tracker, measured, segment->angle, segment->duration);
+			}
+		}
+
+		/* Steps hold the setpoint for many ticks, only ramps and chirps move it every tick */
+		if(s->player.setpoint.x != s->target_euler.x || s->player.setpoint.y != s->target_euler.y ||
+			s->player.setpoint.z != s->target_euler.z) {
+			s->target_euler = s->player.setpoint;
+			s->target = quat_from_euler(s->target_euler);
+		}
+		measured = profile_axis(s->player.setpoint, s->step_axis) + profile_axis(quat_error(q, s->target), s->step_axis);
+		metrics_update(&s->tracker, measured, s->angle_elapsed);
+	}
+
+	if(angle_due) {
+		controller_update_angle(&s->ctrl, q, s->target, s->angle_elapsed);
+		s->angle_elapsed = 0.0;
+	}
+
+	rates = e->w;
+	if(init->spectrum != NULL) {
+		spectrum_push(init->spectrum, e->w);
+
+		/* Keeps the coefficients it has if the analyser is in the middle of publishing */
+		if(spectrum_fetch(init->spectrum, &notches)) {
+			for(num = 0; num < SPECTRUM_NOTCHES; num++) {
+				s->dynamic_notch[num].c = notches.notch[num];
+			}
+		}
+
+		for(num = 0; num < SPECTRUM_NOTCHES; num++) {
+			rates = biquad_apply(&s->dynamic_notch[num], rates);
+		}
+	}
+	if(init->notch_hz > 0.0) {
+		rates = biquad_apply(&s->gyro_notch, rates);
+	}
+	rates = biquad_apply(&s->gyro_lpf, rates);
+	if(s->tuning) {
+		/* The relay drives the jig axis on its own until the experiment is over */
+		memset(&demand, 0, sizeof(demand));
+		demand.z = autotune_update(&s->tune, rates.z, 0.0, e->elapsed);
+
+		if(s->tune.state == AUTOTUNE_FAILED) {
+			printf("The autotune did not settle into an oscillation, stopping\r\n");
+			return 0;
+		}
+
+		if(s->tune.state == AUTOTUNE_DONE) {
+			autotune_gains(&s->tune, init->rule, &s->rate_gains);
+			controller_init(&s->ctrl, s->angle_gains, s->rate_gains, init->loop_hz);
+			set_axis_gains(&s->ctrl, s->rate_gains, init->params);
+			s->tuning = 0;
+
+			/* Reported and stored by save_tuned_gains() */
+			init->tuned_ku = s->tune.ku;
+			init->tuned_tu = s->tune.tu;
+			init->tuned_gains = s->rate_gains;
+			init->tuned = 1;
+			sem_post(init->tuned_sig);
+		}
+	} else {
+		/* No voltage measurement on this board yet */
+		schedule_apply(init->schedule, s->base_throttle, 0.0, &s->ctrl);
+		demand = controller_update_rate(&s->ctrl, rates, e->elapsed);
+	}
+
+	mixer_mix(&s->mix, s->base_throttle, demand, s->motors);
+
+	if(due) {
+		motor_write_us(&s->out, s->motors);
+		written = frame_sync_clock();
+		frame_sync_done(&s->sync, e->sampled, written);
+		predictor_measure(&s->pred, written - e->sampled);
+	}
+
+	if(rate_due(&init->rates, TASK_TELEMETRY, e->tick)) {
+		transfer = triple_buffer_back(init->handoff);
+		transfer->q = e->q; /* The estimate, the prediction is only what the controller acts on */
+		transfer->elapsed = e->elapsed;
+		transfer->latency = predictor_horizon(&s->pred);
+		transfer->throttle = s->motors[0];
+		transfer->setpoint = s->player.setpoint;
+		transfer->step = s->step;
+		transfer->output = s->sync.modelled;
+		transfer->pipeline = s->pipeline;
+		triple_buffer_publish(init->handoff);
+	}
+
+	return 1;
+}
+
+/*
+ * Publish the timing of the acquisition stage, which owns the release of the cycles
+ */
+static void publish_timing(struct rt_state* s, unsigned long tick) {
+	struct rt_timing* timing;
+
+	if(rate_due(&s->init->rates, TASK_TELEMETRY, tick)) {
+		timing = triple_buffer_back(s->init->timing);
+		timing->jitter = s->cycle.jitter;
+		timing->exec = s->cycle.exec;
+		timing->misses = s->cycle.misses;
+		timing->overruns = s->cycle.overruns;
+		triple_buffer_publish(s->init->timing);
+	}
+}
+
+static void* acquisition_thread(void* args) {
+	struct rt_state* s = (struct rt_state*)args;
+	struct acq_msg m;
+
+	while(!atomic_load_explicit(&s->stop, memory_order_relaxed)) {
+		acquire(s, &m);
+		spsc_push(&s->acq_ring, &m);
+		periodic_done(&s->cycle);
+		publish_timing(s, m.tick);
+	}
+
+	return NULL;
+}
+
+static void* estimation_thread(void* args) {
+	struct rt_state* s = (struct rt_state*)args;
+	struct acq_msg a;
+	struct est_msg e;
+
+	while(spsc_pop_wait(&s->acq_ring, &a, &s->stop)) {
+		estimate(s, &a, &e);
+		spsc_push(&s->est_ring, &e);
+	}
+
+	return NULL;
+}
+
 void* rt(void* args) {
-	int gyro, mag, pwm, num, pid, base_throttle, throttle;
+	static struct rt_state state; /* Too big for the stack of the thread */
+	int num;
 	char input[15];
 	double elapsed, kp, ki, kd;
 	struct gyro_state g_state;
-	struct vec3 m_state, dir;
-	struct timeval st, et;
+	struct vec3 m_state, a_sum, m_sum;
+	struct spectrum_result notches;
+	struct acq_msg a;
+	struct est_msg e;
+	pthread_t acq_thread, est_thread;
+	struct timeval st, et, align;
 	struct rt_init* init;
+	struct rt_state* s;
 
 	printf("Entering the real time environment...\r\n");
 
 	init = (struct rt_init*)args;
+	s = &state;
+	s->init = init;
+	atomic_init(&s->stop, 0);
+
+	estimator_init(&s->est, init->estimator);
+	printf("Using the %s attitude estimator\r\n", estimator_name(s->est.type));
+	for(num = 0; num < TASK_COUNT; num++) {
+		printf("Running the %s every %d loops at offset %d\r\n", rate_task_name(num),
+			init->rates.divisor[num], init->rates.offset[num]);
+	}
+
+	mixer_init(&s->mix, init->layout);
+	printf("Driving %d motors in the %s layout\r\n", s->mix.motors, mixer_name(s->mix.layout));
+
+	s->gyro = setup_gyro(ADAPTER_NUMBER);
+	s->mag = setup_mag(ADAPTER_NUMBER);
 
-	gyro = setup_gyro(ADAPTER_NUMBER);
-	mag = setup_mag(ADAPTER_NUMBER);
-	pwm = setup_pwm(ADAPTER_NUMBER);
-	
 	printf("Setting PWM frequency\r\n");
-	set_pwm_frequency(pwm, 50);
-	set_pwm(pwm, 0, 0, 0);
+	if(init->backend == MOTOR_SYSFS) {
+		motor_open_sysfs(&s->out, init->pwm_chip, s->mix.motors, init->pwm_hz, init->protocol);
+	} else {
+		/* Trim for the oscillator of each chip, from a frame measured once with a scope and stored */
+		motor_open_pca9685(&s->out, ADAPTER_NUMBER, s->mix.motors, init->pwm_hz, init->protocol,
+			params_get(init->params, "pwm_trim", 1.0));
+	}
+	printf("Running the ESCs from %s at %.1f Hz with %s pulses\r\n", motor_backend_name(s->out.backend),
+		s->out.hz, pwm_protocol_name(init->protocol));
 	
 	printf("Type \"ARM\" in all capital letters when ready to arm the system: ");
 	scanf("%12[^\n]s", input);
@@ -167,20 +831,73 @@ void* rt(void* args) {
 	}
 
 	printf("System is armed!\r\n");
-	set_pwm(pwm, 0, 0, 205);
+	mixer_idle(&s->mix, s->motors);
+	motor_write_us(&s->out, s->motors);
 
 	scanf("%c", input); /* Clear buffer of invalid /n character */
 
-	printf("Enter kP value: ");
-	scanf("%lf", &kp);
-	printf("Enter kI value: ");
-	scanf("%lf", &ki);
-	printf("Enter kD value: ");
-	scanf("%lf", &kd);
+	if(init->stored_gains) {
+		kp = params_get(init->params, "rate_kp", 0.0);
+		ki = params_get(init->params, "rate_ki", 0.0);
+		kd = params_get(init->params, "rate_kd", 0.0);
+	} else if(init->autotune) {
+		/* Only used after the autotune if it fails, which stops the loop anyway */
+		kp = 0.0;
+		ki = 0.0;
+		kd = 0.0;
+	} else {
+		printf("Enter rate loop kP value: ");
+		scanf("%lf", &kp);
+		printf("Enter rate loop kI value: ");
+		scanf("%lf", &ki);
+		printf("Enter rate loop kD value: ");
+		scanf("%lf", &kd);
+	}
 	printf("Enter base throttle value: ");
-	scanf("%d", &base_throttle);
+	scanf("%d", &s->base_throttle);
+
+	printf("PID is set to kP: %f kI: %f kD: %f Base throttle: %d\r\n", kp, ki, kd, s->base_throttle);
+
+	/* The angle loop only needs to be proportional, the rate loop below it does the real work */
+	s->angle_gains.kp = CONTROL_ANGLE_KP;
+	s->angle_gains.ki = 0.0;
+	s->angle_gains.kd = 0.0;
+	s->angle_gains.kf = 0.0;
+	s->angle_gains.setpoint_weight = 1.0;
+	s->angle_gains.dterm_weight = 1.0;
+	s->angle_gains.i_limit = 0.0;
+	s->angle_gains.out_limit = CONTROL_MAX_RATE;
+
+	s->rate_gains.kp = kp;
+	s->rate_gains.ki = ki;
+	s->rate_gains.kd = kd;
+	s->rate_gains.kf = params_get(init->params, "rate_kf", 0.0);
+	s->rate_gains.setpoint_weight = params_get(init->params, "rate_b", 1.0);
+	s->rate_gains.dterm_weight = params_get(init->params, "rate_c", 0.0); /* Derivative on the gyroscope only */
+	s->rate_gains.i_limit = CONTROL_I_LIMIT;
+	s->rate_gains.out_limit = CONTROL_OUTPUT_LIMIT;
+
+	controller_init(&s->ctrl, s->angle_gains, s->rate_gains, init->loop_hz);
+	set_axis_gains(&s->ctrl, s->rate_gains, init->params);
 
-	printf("PID is set to kP: %f kI: %f kD: %f Base throttle: %d\r\n", kp, ki, kd, base_throttle);
+	/*
+	 * The controller gets a low passed (and optionally notched) copy of the gyroscope rates, the
+	 * estimator integrates the raw rates so no lag is added to the attitude.
+	 */
+	biquad_init_lowpass(&s->gyro_lpf, GYRO_LPF_HZ, init->loop_hz, BIQUAD_Q);
+	if(init->notch_hz > 0.0) {
+		biquad_init_notch(&s->gyro_notch, init->notch_hz, init->loop_hz, NOTCH_Q);
+	}
+	pt1_init(&s->accel_lpf, ACCEL_LPF_HZ, init->loop_hz / init->rates.divisor[TASK_ACCEL]);
+	median3_init(&s->mag_median);
+
+	if(init->spectrum != NULL) {
+		while(!spectrum_fetch(init->spectrum, &notches));
+		for(num = 0; num < SPECTRUM_NOTCHES; num++) {
+			s->dynamic_notch[num].c = notches.notch[num];
+			biquad_reset(&s->dynamic_notch[num]);
+		}
+	}
 
 	scanf("%c", input); /* Clear buffer of invalid /n character */
 
@@ -190,86 +907,181 @@ void* rt(void* args) {
 		printf("Invalid throttle key, not continuing!\r\n");
 		exit(1);
 	}
-	
-	gettimeofday(&st, NULL);
 
-	while(sem_trywait(init->kill_sig) != 0) {
-		g_state = get_gyro_state(gyro);
-		m_state = get_mag_state(mag);
+	/*
+	 * Start the estimator from the averaged accelerometer and magnetometer readings instead of
+	 * the identity and wait for it to settle before the controller is allowed to use it.
+	 */
+	printf("Aligning the attitude, keep the system still...\r\n");
+	gettimeofday(&align, NULL);
+
+	memset(&a_sum, 0, sizeof(a_sum));
+	memset(&m_sum, 0, sizeof(m_sum));
+	for(num = 0; num < ALIGN_SAMPLES; num++) {
+		g_state = get_gyro_state(s->gyro);
+		m_state = get_mag_state(s->mag);
+		a_sum.x += g_state.a.x;
+		a_sum.y += g_state.a.y;
+		a_sum.z += g_state.a.z;
+		m_sum.x += m_state.x;
+		m_sum.y += m_state.y;
+		m_sum.z += m_state.z;
+	}
+	estimator_align(&s->est, a_sum, m_sum); /* Only the directions matter so the sums are fine */
 
-		gettimeofday(&et, NULL);
+	gettimeofday(&st, NULL);
+	do {
+		g_state = get_gyro_state(s->gyro);
+		m_state = get_mag_state(s->mag);
 
+		gettimeofday(&et, NULL);
 		elapsed = (et.tv_sec - st.tv_sec) + ((et.tv_usec - st.tv_usec) / 1000000.0f);
-		dir = get_angle(g_state.w, g_state.a, m_state, elapsed);
-		pid = get_pid(dir, kp, ki, kd, elapsed);
-		throttle = base_throttle + pid;
-		set_pwm_us(pwm, 0, throttle);
-		
-		gettimeofday(&st, NULL);
-
-		/* 
-		 * Make sure that nothing else is reading from the memory for some reason.
-		 * Read the sensor again if something is blocking in order to not waste time 
-		 * this also prevents a deadlock because this thread will always take priority
-		 * and will spin lock forever because the system won't relenquish control to
-		 * the lower priority threads.
+		st = et;
+
+		get_attitude(&s->est, g_state.w, g_state.a, m_state, elapsed);
+
+		elapsed = (et.tv_sec - align.tv_sec) + ((et.tv_usec - align.tv_usec) / 1000000.0f);
+		if(elapsed > ALIGN_TIMEOUT) {
+			printf("The attitude did not become valid in %.0f seconds, not continuing!\r\n", ALIGN_TIMEOUT);
+			exit(1);
+		}
+	} while(!estimator_valid(&s->est, g_state.a));
+
+	printf("Attitude valid after %.0f ms\r\n", elapsed * 1000.0);
+
+	predictor_init(&s->pred, s->out.hz); /* The frames are only modelled, keep the average half frame wait */
+
+	frame_sync_init(&s->sync, s->out.epoch + params_get(init->params, "pwm_phase", 0.0) / 1000000.0, s->out.hz);
+
+	s->tuning = init->autotune;
+	if(s->tuning) {
+		printf("Autotuning the yaw rate loop with the %s rule...\r\n", autotune_rule_name(init->rule));
+		autotune_init(&s->tune, AUTOTUNE_AMPLITUDE, AUTOTUNE_HYSTERESIS);
+	}
+
+	s->target = QUAT_IDENTITY;
+	memset(&s->target_euler, 0, sizeof(s->target_euler));
+	memset(&s->step, 0, sizeof(s->step));
+	metrics_init(&s->tracker);
+	s->step_axis = AXIS_YAW;
+	memset(&s->player, 0, sizeof(s->player));
+	if(init->profile != NULL) {
+		printf("Playing a profile of %d segments\r\n", init->profile->count);
+		profile_start(&s->player, init->profile);
+	}
+
+	/* Release the loop at a fixed rate, lined up so that a cycle starts LOOP_LEAD ahead of every PWM frame */
+	periodic_init(&s->cycle, 1.0 / init->loop_hz, s->sync.epoch - FRAME_GUARD - LOOP_LEAD, init->overrun);
+	printf("Running the loop at %.1f Hz, overruns %s\r\n", 1.0 / periodic_period(&s->cycle), overrun_policy_name(s->cycle.policy));
+
+	histogram_init(&s->pipeline, 0.0, 2.0 / init->loop_hz);
+	s->angle_elapsed = 0.0;
+	s->tick = 0;
+	s->last_sample = frame_sync_clock();
+
+	if(init->pipelined) {
+		/*
+		 * Every stage on its own core, while this thread runs the controller on cycle n the
+		 * estimator is already on cycle n + 1 and the sensors are being read for n + 2
 		 */
-		if(pthread_mutex_trylock(init->trans_mutex) == 0) {
-			// printf("Transmitting the data to the main thread over shared memory\r\n");
-			init->transfer->dir = dir;
-			init->transfer->elapsed = elapsed;
-			init->transfer->throttle = throttle;
-			pthread_mutex_unlock(init->trans_mutex);
+		printf("Pipelining acquisition, estimation and control on cores %d, %d and %d\r\n",
+			init->cores[PIPELINE_ACQUIRE], init->cores[PIPELINE_ESTIMATE], init->cores[PIPELINE_CONTROL]);
+
+		spsc_init(&s->acq_ring, s->acq_slots, sizeof(struct acq_msg), PIPELINE_RING_SIZE);
+		spsc_init(&s->est_ring, s->est_slots, sizeof(struct est_msg), PIPELINE_RING_SIZE);
+
+		est_thread = create_rt_thread(estimation_thread, s, init->cores[PIPELINE_ESTIMATE]);
+		acq_thread = create_rt_thread(acquisition_thread, s, init->cores[PIPELINE_ACQUIRE]);
+
+		while(sem_trywait(init->kill_sig) != 0 && spsc_pop_wait(&s->est_ring, &e, &s->stop)) {
+			if(!control(s, &e)) {
+				break;
+			}
 		}
 
-		usleep(100); // Relinquish control to the main thread for a bit
+		atomic_store(&s->stop, 1);
+		pthread_join(acq_thread, NULL);
+		pthread_join(est_thread, NULL);
+	} else {
+		while(sem_trywait(init->kill_sig) != 0) {
+			acquire(s, &a);
+			estimate(s, &a, &e);
+			if(!control(s, &e)) {
+				break;
+			}
+			periodic_done(&s->cycle);
+			publish_timing(s, a.tick);
+		}
 	}
 
-	set_pwm(pwm, 0, 0, 0);
+	motor_close(&s->out);
+
+	/* Every run reports its own real time behaviour */
+	printf("Ran %lu cycles, %lu overruns, %lu skipped releases and %lu deadline misses\r\n",
+		s->cycle.cycles, s->cycle.overruns, s->cycle.skipped, s->cycle.misses);
+	histogram_print(&s->cycle.jitter, "Loop jitter", 1000000.0, "us");
+	histogram_print(&s->cycle.exec, init->pipelined ? "Acquisition execution time" : "Loop execution time", 1000000.0, "us");
+	histogram_print(&s->pipeline, "Sensor sample to control", 1000000.0, "us");
+	histogram_print(&s->sync.modelled, "Output latency modelled from the frame phase", 1000.0, "ms");
+	if(init->pipelined) {
+		printf("Dropped %lu samples and %lu attitudes between the stages\r\n", s->acq_ring.dropped, s->est_ring.dropped);
+	}
 
 	printf("Exiting the real time environment\r\n");
 }
 
 /*
- * Based on tutorial here: https://electronoobs.com/eng_robotica_tut6_2.php
+ * Wait for the loop to finish the autotune, then report the gains it found and store them
  */
-int get_pid(struct vec3 dir, double kp, double ki, double kd, double elapsed) {
-	double error, p, i, d;
-	int pid;
+void* save_tuned_gains(void* args) {
+	struct rt_init* init = (struct rt_init*)args;
 
-	static double prev_error = 0;
-
-	const static double target_angle = 0;
+	while(sem_wait(init->tuned_sig) != 0);
+	if(!init->tuned) {
+		return NULL;
+	}
 
-	error = dir.z - target_angle;
-	    
-	p = kp * error;
+	printf("Ultimate gain %f period %f s, PID is set to kP: %f kI: %f kD: %f\r\n",
+		init->tuned_ku, init->tuned_tu, init->tuned_gains.kp, init->tuned_gains.ki, init->tuned_gains.kd);
 
-	if(-3 < error < 3) {
-		  i = i + (ki * error);  
+	/* The loop is done reading the store once it posted */
+	params_set(init->params, "rate_kp", init->tuned_gains.kp);
+	params_set(init->params, "rate_ki", init->tuned_gains.ki);
+	params_set(init->params, "rate_kd", init->tuned_gains.kd);
+	if(params_save(init->params) != 0) {
+		printf("The new gains were not stored\r\n");
 	}
 
-	d = kd * ((error - prev_error) / elapsed);
-
-	pid = p + i + d;
+	return NULL;
+}
 
-	// printf("p %f, i %f, d %f, pid %d, error %f, prev_error %f\r\n", p, i, d, pid, error, prev_error);
+/*
+ * Let the stored parameters override the feed-forward and the setpoint weights of single axes of
+ * the rate loop, e.g. rate_kf_yaw, rate_b_roll or rate_c_pitch
+ */
+void set_axis_gains(struct controller* c, struct pid_gains gains, struct params* p) {
+	struct pid_gains g;
+	char name[32];
+	int axis;
 
-	if(pid < -1000) {
-		  pid = -1000;
-	}
+	for(axis = 0; axis < CONTROL_AXES; axis++) {
+		g = gains;
 
-	if(pid > 1000) {
-		  pid = 1000;
-	}
+		snprintf(name, sizeof(name), "rate_kf_%s", control_axis_name(axis));
+		g.kf = params_get(p, name, gains.kf);
+		snprintf(name, sizeof(name), "rate_b_%s", control_axis_name(axis));
+		g.setpoint_weight = params_get(p, name, gains.setpoint_weight);
+		snprintf(name, sizeof(name), "rate_c_%s", control_axis_name(axis));
+		g.dterm_weight = params_get(p, name, gains.dterm_weight);
 
-	prev_error = error;
+		controller_set_rate_gains(c, axis, g);
 
-	return pid;
+		printf("The %s rate loop has kF: %f setpoint weight: %f derivative weight: %f\r\n",
+			control_axis_name(axis), g.kf, g.setpoint_weight, g.dterm_weight);
+	}
 }
 
-
-pthread_t create_rt_thread(void*(*fun)(void*), struct rt_init* init) {
+pthread_t create_rt_thread(void*(*fun)(void*), void* args, int cpu) {
 	/*
 	 * Create a thread with the correct settings for operating under PREEMPT RT.
 	 *
@@ -279,6 +1091,7 @@ pthread_t create_rt_thread(void*(*fun)(void*), struct rt_init* init) {
 
 	struct sched_param s_param;
 	pthread_attr_t t_attr;
+	cpu_set_t cpus;
 	pthread_t rt_thread;
 	int ret;
 
@@ -322,7 +1135,17 @@ pthread_t create_rt_thread(void*(*fun)(void*), struct rt_init* init) {
 		exit(1);
 	}
 
-	ret = pthread_create(&rt_thread, &t_attr, fun, (void*)init);
+	if(cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		ret = pthread_attr_setaffinity_np(&t_attr, sizeof(cpus), &cpus); /* Keep the thread on its own core */
+		if (ret != 0) {
+			printf("Pinning the thread to CPU %d failed\r\n", cpu);
+			exit(1);
+		}
+	}
+
+	ret = pthread_create(&rt_thread, &t_attr, fun, args);
 	if (ret != 0) {
 		printf("Creating the pthread failed\r\n");
 	}
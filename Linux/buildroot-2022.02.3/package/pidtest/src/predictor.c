@@ -0,0 +1,50 @@
+#include "gyro.h"
+#include "quaternion.h"
+#include "predictor.h"
+
+/*
+ * Set up the predictor for a PWM frame rate in Hz, the new pulse goes out half a frame after the
+ * write on average
+ */
+void predictor_init(struct predictor* p, double pwm_hz) {
+	p->latency = -1.0;
+	p->frame_delay = 0.5 / pwm_hz;
+}
+
+/*
+ * Add a measurement of the time between sampling the sensors and finishing the output write
+ */
+void predictor_measure(struct predictor* p, double latency) {
+	if(latency < 0.0 || latency > PREDICTOR_MAX_LATENCY) {
+		return; /* Clock jump or a stall that is not worth adapting to */
+	}
+
+	if(p->latency < 0.0) {
+		p->latency = latency;
+	} else {
+		p->latency += PREDICTOR_SMOOTHING * (latency - p->latency);
+	}
+}
+
+/*
+ * Get how far ahead in seconds the attitude is currently predicted
+ */
+double predictor_horizon(struct predictor* p) {
+	if(p->latency < 0.0) {
+		return p->frame_delay;
+	}
+
+	return p->latency + p->frame_delay;
+}
+
+/*
+ * Extrapolate the attitude q forward by the measured latency with the body rates w (degrees per
+ * second) so the controller acts on where the air craft will be when the output changes
+ */
+struct quaternion predict_attitude(struct predictor* p, struct quaternion q, struct vec3 w) {
+	w.x *= 0.017453;
+	w.y *= 0.017453;
+	w.z *= 0.017453;
+
+	return quat_normalise(quat_integrate(q, w, predictor_horizon(p)));
+}
@@ -0,0 +1,29 @@
+#include "quaternion.h"
+
+/*
+ * Latency compensation for the attitude.
+ *
+ * By the time the ESC sees a new pulse the attitude it was computed from is already old: the
+ * sensors have to be read over the bus, the estimator and the PID have to run, the PWM controller
+ * has to be written and then the new pulse only goes out at the start of the next PWM frame.  The
+ * predictor measures the sensor to output part of that delay online and extrapolates the attitude
+ * forward over it (plus the frame delay) with the latest gyroscope rates.
+ */
+
+#ifndef _PREDICTOR_H
+#define _PREDICTOR_H
+
+static const double PREDICTOR_SMOOTHING = 0.05; /* Weight of a new latency measurement */
+static const double PREDICTOR_MAX_LATENCY = 0.1; /* Measurements above this (seconds) are outliers */
+
+struct predictor {
+	double latency;     /* Smoothed sensor to output latency in seconds, negative until measured */
+	double frame_delay; /* Average wait for the next PWM frame in seconds */
+};
+
+void predictor_init(struct predictor*, double);
+void predictor_measure(struct predictor*, double);
+double predictor_horizon(struct predictor*);
+struct quaternion predict_attitude(struct predictor*, struct quaternion, struct vec3);
+
+#endif
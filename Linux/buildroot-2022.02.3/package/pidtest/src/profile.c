@@ -0,0 +1,201 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gyro.h"
+#include "control.h"
+#include "profile.h"
+
+/*
+ * Built in profiles in the file format, one segment per line
+ */
+static const struct {
+	const char* name;
+	const char* lines;
+} BUILTIN[] = {
+	{ "steps", "hold 2\nstep yaw 15 4\nstep yaw 0 4\nstep yaw -15 4\nstep yaw 0 4\n" },
+	{ "ramp", "hold 2\nramp yaw 30 6\nhold 2\nramp yaw 0 6\n" },
+	{ "chirp", "hold 2\nchirp yaw 5 0.2 5 30\nhold 2\n" }
+};
+
+/*
+ * Component of a vector along a control axis
+ */
+double profile_axis(struct vec3 v, int axis) {
+	return axis == AXIS_ROLL ? v.x : axis == AXIS_PITCH ? v.y : v.z;
+}
+
+static void set_axis(struct vec3* v, int axis, double value) {
+	if(axis == AXIS_ROLL) {
+		v->x = value;
+	} else if(axis == AXIS_PITCH) {
+		v->y = value;
+	} else {
+		v->z = value;
+	}
+}
+
+/*
+ * Parse one line of a profile into the next segment, returns -1 if it isn't valid
+ */
+static int parse_segment(struct profile* p, const char* line) {
+	struct profile_segment* seg;
+	char kind[16], axis[16];
+	int n;
+
+	if(sscanf(line, "%15s", kind) != 1 || kind[0] == '#') {
+		return 0;
+	}
+
+	if(p->count >= PROFILE_MAX_SEGMENTS) {
+		return -1;
+	}
+
+	seg = &p->segments[p->count];
+	memset(seg, 0, sizeof(*seg));
+
+	if(strcmp(kind, "hold") == 0) {
+		seg->type = SEGMENT_HOLD;
+		n = sscanf(line, "%*s %lf", &seg->duration) == 1;
+	} else if(strcmp(kind, "step") == 0 || strcmp(kind, "ramp") == 0) {
+		seg->type = kind[0] == 's' ? SEGMENT_STEP : SEGMENT_RAMP;
+		n = sscanf(line, "%*s %15s %lf %lf", axis, &seg->angle, &seg->duration) == 3;
+		seg->axis = control_axis_from_name(axis);
+	} else if(strcmp(kind, "chirp") == 0) {
+		seg->type = SEGMENT_CHIRP;
+		n = sscanf(line, "%*s %15s %lf %lf %lf %lf", axis, &seg->angle, &seg->f0, &seg->f1, &seg->duration) == 5;
+		seg->axis = control_axis_from_name(axis);
+	} else {
+		return -1;
+	}
+
+	if(!n || seg->axis < 0 || seg->duration <= 0.0) {
+		return -1;
+	}
+
+	p->count++;
+
+	return 0;
+}
+
+/*
+ * Load a built in profile by name or a profile file, returns -1 (after saying why) on failure
+ */
+int profile_load(struct profile* p, const char* name) {
+	char line[256];
+	const char* s;
+	FILE* file;
+	int i, number;
+
+	memset(p, 0, sizeof(*p));
+
+	for(i = 0; i < (int)(sizeof(BUILTIN) / sizeof(BUILTIN[0])); i++) {
+		if(strcmp(name, BUILTIN[i].name) == 0) {
+			for(s = BUILTIN[i].lines; *s != '\0'; s = strchr(s, '\n') + 1) {
+				parse_segment(p, s);
+			}
+			return 0;
+		}
+	}
+
+	file = fopen(name, "r");
+	if(file == NULL) {
+		printf("There is no profile called %s\r\n", name);
+		return -1;
+	}
+
+	number = 0;
+	while(fgets(line, sizeof(line), file) != NULL) {
+		number++;
+		if(parse_segment(p, line) != 0) {
+			printf("Invalid line %d in the profile %s\r\n", number, name);
+			fclose(file);
+			return -1;
+		}
+	}
+
+	fclose(file);
+
+	return 0;
+}
+
+/*
+ * Start playing a profile from a level setpoint
+ */
+void profile_start(struct profile_player* pl, const struct profile* p) {
+	memset(pl, 0, sizeof(*pl));
+	pl->profile = p;
+}
+
+/*
+ * The segment being played, NULL once the profile is over
+ */
+const struct profile_segment* profile_segment(struct profile_player* pl) {
+	if(pl->index >= pl->profile->count) {
+		return NULL;
+	}
+
+	return &pl->profile->segments[pl->index];
+}
+
+/*
+ * Advance the profile by deltat seconds and update the setpoint.  Returns 1 when a new segment
+ * started in this update so the caller can start measuring it.
+ */
+int profile_update(struct profile_player* pl, double deltat) {
+	const struct profile_segment* seg;
+	double phase, value;
+	int started = 0;
+
+	seg = profile_segment(pl);
+	if(seg == NULL) {
+		return 0;
+	}
+
+	if(!pl->playing) {
+		pl->playing = 1;
+		pl->start = profile_axis(pl->setpoint, seg->axis);
+		started = 1;
+	}
+
+	pl->t += deltat;
+	while(pl->t >= seg->duration) {
+		/* Leave the axis exactly where the segment ends */
+		if(seg->type == SEGMENT_STEP || seg->type == SEGMENT_RAMP) {
+			set_axis(&pl->setpoint, seg->axis, seg->angle);
+		} else if(seg->type == SEGMENT_CHIRP) {
+			set_axis(&pl->setpoint, seg->axis, pl->start);
+		}
+
+		pl->t -= seg->duration;
+		pl->index++;
+		started = 1;
+
+		seg = profile_segment(pl);
+		if(seg == NULL) {
+			return 1;
+		}
+		pl->start = profile_axis(pl->setpoint, seg->axis);
+	}
+
+	switch(seg->type) {
+	case SEGMENT_STEP:
+		value = seg->angle;
+		break;
+	case SEGMENT_RAMP:
+		value = pl->start + (seg->angle - pl->start) * pl->t / seg->duration;
+		break;
+	case SEGMENT_CHIRP:
+		/* Linear sweep, the phase is the integral of the frequency */
+		phase = 2.0 * M_PI * (seg->f0 * pl->t + 0.5 * (seg->f1 - seg->f0) * pl->t * pl->t / seg->duration);
+		value = pl->start + seg->angle * sin(phase);
+		break;
+	default:
+		value = profile_axis(pl->setpoint, seg->axis);
+		break;
+	}
+
+	set_axis(&pl->setpoint, seg->axis, value);
+
+	return started;
+}
@@ -0,0 +1,59 @@
+#include "gyro.h"
+
+/*
+ * Scripted setpoints for the attitude controller.
+ *
+ * A profile is a list of segments played one after the other, every segment moves one axis (roll,
+ * pitch or yaw, angles in degrees) and the setpoint stays where the last segment left it:
+ *
+ * step <axis> <angle> <seconds>                    jump to angle and hold it
+ * ramp <axis> <angle> <seconds>                    move linearly to angle
+ * chirp <axis> <amplitude> <f0> <f1> <seconds>     sine sweep from f0 to f1 Hz around the setpoint
+ * hold <seconds>                                   keep the setpoint
+ *
+ * Profiles are loaded from a file with one segment per line or picked by name from the built in
+ * ones (steps, ramp, chirp) which all work on the yaw axis of the test jig.
+ */
+
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#define PROFILE_MAX_SEGMENTS 64
+
+enum segment_type {
+	SEGMENT_HOLD,
+	SEGMENT_STEP,
+	SEGMENT_RAMP,
+	SEGMENT_CHIRP
+};
+
+struct profile_segment {
+	enum segment_type type;
+	int axis;
+	double angle;     /* End point of a step or ramp, amplitude of a chirp */
+	double f0;
+	double f1;
+	double duration;
+};
+
+struct profile {
+	int count;
+	struct profile_segment segments[PROFILE_MAX_SEGMENTS];
+};
+
+struct profile_player {
+	const struct profile* profile;
+	int index;         /* Segment being played, count when the profile is over */
+	int playing;       /* Set once the first segment started */
+	double t;          /* Time into the segment */
+	double start;      /* Setpoint of the segment axis when the segment started */
+	struct vec3 setpoint;
+};
+
+int profile_load(struct profile*, const char*);
+void profile_start(struct profile_player*, const struct profile*);
+int profile_update(struct profile_player*, double);
+const struct profile_segment* profile_segment(struct profile_player*);
+double profile_axis(struct vec3, int);
+
+#endif
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <linux/i2c.h>
@@ -11,17 +13,65 @@
 #include "pwm.h"
 #include "i2c.h"
 
+static const char* PROTOCOL_NAMES[PWM_PROTOCOL_COUNT] = {
+	[PWM_STANDARD] = "standard",
+	[PWM_ONESHOT125] = "oneshot125"
+};
+
+int pwm_protocol_from_name(const char* name) {
+	int i;
+
+	for(i = 0; i < PWM_PROTOCOL_COUNT; i++) {
+		if(strcmp(name, PROTOCOL_NAMES[i]) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+const char* pwm_protocol_name(enum pwm_protocol protocol) {
+	return PROTOCOL_NAMES[protocol];
+}
+
+/*
+ * Factor from the 1000-2000 us throttle range to the pulses of a protocol
+ */
+double pwm_protocol_scale(enum pwm_protocol protocol) {
+	return protocol == PWM_ONESHOT125 ? PWM_ONESHOT_SCALE : 1.0;
+}
+
+/*
+ * Fastest frame rate that still fits the longest pulse of a protocol
+ */
+double pwm_protocol_max_hz(enum pwm_protocol protocol) {
+	return protocol == PWM_ONESHOT125 ? PWM_MAX_ONESHOT_HZ : PWM_MAX_STANDARD_HZ;
+}
+
 /*
  * Setup the PWM controller over the I2C bus
  */
-int setup_pwm(int adapter_nr) {
+void setup_pwm(struct pwm* p, int adapter_nr) {
 
 	int pwm;
 	__s32 res;
 	__u8 mode1;
+	int i;
+
+	p->oscillator = PWM_OSCILLATOR;
+	p->hz = PWM_DEFAULT_HZ;
+	p->tick_us = 1000000.0 / p->hz / PWM_RESOLUTION;
+	p->epoch = 0.0;
+	p->scale = 1.0;
+	for(i = 0; i < PWM_CHANNELS; i++) {
+		p->dither[i] = 0.0;
+		p->pending[i] = 0.0;
+		p->frame[i] = -1;
+	}
 
 	pwm = instantiate_device(adapter_nr, PWM_ADDRESS); /* Instantiate the PWM device */
-	set_all_pwm(pwm, 0, 0);
+	p->file = pwm;
+	set_all_pwm(p, 0, 0);
 
 	res = i2c_smbus_write_byte_data(pwm, MODE2, OUTDRV); /* Configure for totem pole structure so pull up is not necesary */
 	if(res != 0) {
@@ -29,7 +79,7 @@ int setup_pwm(int adapter_nr) {
 		exit(1);
 	}
 
-	res = i2c_smbus_write_byte_data(pwm, MODE1, ALLCALL); /* Allow all channels to be treated as a group */
+	res = i2c_smbus_write_byte_data(pwm, MODE1, ALLCALL | AI); /* Allow all channels to be treated as a group and auto increment the register address */
 	if(res != 0) {
 		printf("Failed to set MODE2 value\r\n");
 		exit(1);
@@ -43,24 +93,38 @@ int setup_pwm(int adapter_nr) {
 		printf("Failed to take the chip out of sleep\r\n");
 		exit(1);
 	}
-	
-	return pwm;
 }
 
 /*
- * Set the frequency of a period for the PWM signals
+ * Trim the nominal 25 MHz of the internal oscillator by a factor, e.g. from a frame length measured
+ * once with a scope.  Takes effect on the next set_pwm_frequency().
+ */
+void set_pwm_trim(struct pwm* p, double trim) {
+	p->oscillator = PWM_OSCILLATOR * trim;
+}
+
+/*
+ * Set the frequency of a period for the PWM signals, returns the frequency the prescaler really gives
  */
-void set_pwm_frequency(int file, double hz) {
+double set_pwm_frequency(struct pwm* p, double hz) {
+	int file = p->file;
 	double pre_scale_val;
 	__s32 res;
 	__u8 pre_scale, old_mode, new_mode;
+	struct timespec ts;
+	int i;
 
-	pre_scale_val = 25000000.0; // 25 Mhz
-	pre_scale_val /= 4096; // 12 bit
+	pre_scale_val = p->oscillator;
+	pre_scale_val /= PWM_RESOLUTION; // 12 bit
 	pre_scale_val /= hz;
 	pre_scale_val -= 1.0;
 
-	pre_scale = (__u8)(floor(pre_scale_val + 0.5));
+	pre_scale_val = floor(pre_scale_val + 0.5);
+	if(pre_scale_val < PWM_MIN_PRESCALE || pre_scale_val > PWM_MAX_PRESCALE) {
+		printf("The PWM frequency %.1f Hz is out of range\r\n", hz);
+		exit(1);
+	}
+	pre_scale = (__u8)pre_scale_val;
 	old_mode = i2c_smbus_read_byte_data(file, MODE1); /* Read the MODE1 value */
 
 	new_mode = (old_mode & 0x7F) | SLEEP; /* Configure address to go to sleep */
@@ -88,12 +152,51 @@ void set_pwm_frequency(int file, double hz) {
 		printf("Failed to restart the chip %d\r\n", res);
 		exit(1);
 	}
+
+	/*
+	 * The counter starts from 0 once the oscillator is running again, which is the only point where
+	 * the phase of the frames can be known without a scope.  It is off by about the length of the
+	 * restart write, the pwm_phase parameter trims it.  Nothing checks it afterwards, an oscillator
+	 * that is a little off moves the real frames away from it.
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	p->epoch = ts.tv_sec + ts.tv_nsec / 1000000000.0 + PWM_STARTUP;
+
+	p->hz = p->oscillator / PWM_RESOLUTION / (pre_scale + 1);
+	p->tick_us = 1000000.0 / p->hz / PWM_RESOLUTION;
+	for(i = 0; i < PWM_CHANNELS; i++) {
+		p->dither[i] = 0.0;
+		p->pending[i] = 0.0;
+		p->frame[i] = -1;
+	}
+
+	return p->hz;
+}
+
+double get_pwm_frequency(struct pwm* p) {
+	return p->hz;
+}
+
+/*
+ * Time a frame started on CLOCK_MONOTONIC, every following frame starts a whole period after it
+ */
+double get_pwm_epoch(struct pwm* p) {
+	return p->epoch;
+}
+
+/*
+ * Pick the pulse encoding, OneShot125 (an eighth of the width) lets frames faster than
+ * PWM_MAX_STANDARD_HZ still fit the whole throttle range
+ */
+void set_pwm_protocol(struct pwm* p, enum pwm_protocol protocol) {
+	p->scale = pwm_protocol_scale(protocol);
 }
 
 /*
  * Set the PWM signal on a channels 0-15 of the controller
  */
-void set_pwm(int file, int channel, int on, int off) {
+void set_pwm(struct pwm* p, int channel, int on, int off) {
+	int file = p->file;
 	__s32 res;
 	/* 
 	 * "On" is the starting point on the 0-4096 "number line" where the signal starts and "off" is
@@ -123,13 +226,101 @@ void set_pwm(int file, int channel, int on, int off) {
 	}
 }
 
-void set_pwm_us(int file, int channel, int us) {
-	int pulse_length;
+/*
+ * Convert a pulse width in microseconds to ticks of the 12 bit counter for a channel.
+ *
+ * A tick is about 5 us at 50 Hz and only 0.16 us at 1500 Hz (less with OneShot125), rounding every
+ * frame the same way would lose whatever falls between two ticks.  The rounding error is carried
+ * over to the next frame of the channel instead so the average pulse over the frames is exact.
+ * Only the last write before a frame boundary goes out, so the error of a write is only carried
+ * once the (modelled) frame it went out in is over, the writes before it in the same frame were
+ * never seen.  A frame that repeats the previous pulse because nothing was written doesn't dither.
+ */
+static int pwm_ticks(struct pwm* p, int channel, int us) {
+	struct timespec ts;
+	long long frame;
+	double exact;
+	int ticks;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	frame = (long long)floor((ts.tv_sec + ts.tv_nsec / 1000000000.0 - p->epoch) * p->hz);
+	if(frame != p->frame[channel]) {
+		p->dither[channel] = p->pending[channel];
+		p->frame[channel] = frame;
+	}
+
+	exact = us * p->scale / p->tick_us + p->dither[channel];
+	ticks = (int)floor(exact + 0.5);
+
+	if(ticks < 0) {
+		ticks = 0;
+	} else if(ticks > PWM_RESOLUTION - 1) {
+		ticks = PWM_RESOLUTION - 1;
+	}
 
-	pulse_length = (1000000 / 50) / 4096;
-	us /= pulse_length;
+	/* Don't let a clamped pulse build up a debt it can never pay back */
+	p->pending[channel] = fmax(-0.5, fmin(0.5, exact - ticks));
+
+	return ticks;
+}
+
+void set_pwm_us(struct pwm* p, int channel, int us) {
+	if(channel < PWM_CHANNELS && channel > -1) {
+		set_pwm(p, channel, 0, pwm_ticks(p, channel, us));
+	}
+}
+
+/*
+ * Set the pulses (starting at 0, ending at off) of count consecutive channels starting at channel.
+ *
+ * The register address auto increments (set up in setup_pwm()) so the four registers of up to
+ * PWM_BLOCK_CHANNELS channels go out in one I2C transaction instead of one per register, and all the
+ * channels in it change on the same PWM frame.
+ */
+void set_pwm_block(struct pwm* p, int channel, const int* off, int count) {
+	__u8 data[PWM_BLOCK_CHANNELS * 4];
+	__s32 res;
+	int i, n;
+
+	if(channel < 0 || count < 0 || channel + count > PWM_CHANNELS) {
+		printf("Invalid pwm channels %d to %d\r\n", channel, channel + count - 1);
+		exit(1);
+	}
+
+	while(count > 0) {
+		n = count < PWM_BLOCK_CHANNELS ? count : PWM_BLOCK_CHANNELS;
+
+		for(i = 0; i < n; i++) {
+			data[4 * i] = 0;
+			data[4 * i + 1] = 0;
+			data[4 * i + 2] = (__u8)(off[i] & 0xFF);
+			data[4 * i + 3] = (__u8)(off[i] >> 8);
+		}
+
+		res = i2c_smbus_write_i2c_block_data(p->file, LED0_ON_L + (4 * channel), 4 * n, data);
+		if(res != 0) {
+			printf("Failed to set pwm block %d\r\n", res);
+			exit(1);
+		}
+
+		channel += n;
+		off += n;
+		count -= n;
+	}
+}
+
+/*
+ * Set the pulse widths in microseconds of count consecutive channels in one block write
+ */
+void set_pwm_us_block(struct pwm* p, int channel, const int* us, int count) {
+	int off[PWM_CHANNELS];
+	int i;
+
+	for(i = 0; i < count && channel >= 0 && channel + i < PWM_CHANNELS; i++) {
+		off[i] = pwm_ticks(p, channel + i, us[i]);
+	}
 
-	set_pwm(file, channel, 0, us);
+	set_pwm_block(p, channel, off, count);
 }
 
 
@@ -137,7 +328,8 @@ void set_pwm_us(int file, int channel, int us) {
 /*
  * Set the PWM signal on all channels of the controller
  */
-void set_all_pwm(int file, int on, int off) {
+void set_all_pwm(struct pwm* p, int on, int off) {
+	int file = p->file;
 	__s32 res;
 	/* 
 	 * "On" is the starting point on the 0-4096 "number line" where the signal starts and "off" is
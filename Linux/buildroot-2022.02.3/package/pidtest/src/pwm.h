@@ -22,6 +22,7 @@ static const int PWM_ADDRESS = 0x40; /* I2C address for the PWM controller */
 static const __u8 RESTART       = 0x80;
 static const __u8 SLEEP         = 0x10;
 static const __u8 ALLCALL       = 0x01;
+static const __u8 AI            = 0x20;
 static const __u8 INVRT         = 0x10;
 static const __u8 OUTDRV        = 0x04;
 static const __u8 MODE1         = 0x00;
@@ -36,11 +37,60 @@ static const __u8 ALL_LED_ON_H  = 0xFB;
 static const __u8 ALL_LED_OFF_L = 0xFC;
 static const __u8 ALL_LED_OFF_H = 0xFD;
 
-int setup_pwm(int);
+#define PWM_CHANNELS 16
+#define PWM_BLOCK_CHANNELS 8 /* Channels that fit in one 32 byte SMBus block write */
 
-void set_pwm_frequency(int, double);
-void set_pwm(int, int, int, int);
-void set_pwm_us(int, int, int);
-void set_all_pwm(int, int, int);
+static const double PWM_OSCILLATOR = 25000000.0; /* Nominal internal oscillator in Hz, real chips are a few % off */
+static const double PWM_DEFAULT_HZ = 50.0;       /* Frame assumed until set_pwm_frequency() is called */
+static const int PWM_RESOLUTION = 4096;          /* Ticks of the 12 bit counter per frame */
+static const int PWM_MIN_PRESCALE = 3;          /* Smallest prescaler the chip accepts, about 1526 Hz */
+static const int PWM_MAX_PRESCALE = 255;        /* About 24 Hz */
+static const double PWM_MAX_STANDARD_HZ = 490.0; /* Fastest frame that still fits a 2000 us pulse with a gap */
+static const double PWM_MAX_ONESHOT_HZ = 3920.0; /* Same for a 250 us OneShot125 pulse */
+static const double PWM_ONESHOT_SCALE = 0.125;   /* OneShot125 sends the 1000-2000 us range as 125-250 us */
+static const double PWM_STARTUP = 0.0005;        /* Oscillator start up after a restart in seconds */
+
+/*
+ * Pulse encoding expected by the ESCs
+ */
+enum pwm_protocol {
+	PWM_STANDARD,   /* 1000-2000 us, frames up to PWM_MAX_STANDARD_HZ */
+	PWM_ONESHOT125, /* 125-250 us, frames up to PWM_MAX_ONESHOT_HZ */
+	PWM_PROTOCOL_COUNT
+};
+
+/*
+ * One PCA9685 and the frame it is really running, worked out from the prescaler that was written
+ * and the (trimmed) oscillator, so the pulse widths follow whatever set_pwm_frequency() rounded to
+ */
+struct pwm {
+	int file;                    /* I2C device */
+	double oscillator;           /* Nominal oscillator times the trim, nothing here measures it */
+	double hz;
+	double tick_us;
+	double epoch;                /* Start of a frame on CLOCK_MONOTONIC, in seconds */
+	double scale;                /* Applied to the pulse widths, PWM_ONESHOT_SCALE for OneShot125 */
+	double dither[PWM_CHANNELS]; /* Part of a tick owed to each channel by its previous frames */
+	double pending[PWM_CHANNELS]; /* Owed after the last write, only carried over once its frame starts */
+	long long frame[PWM_CHANNELS]; /* Frame the last write of each channel went out in */
+};
+
+int pwm_protocol_from_name(const char*);
+const char* pwm_protocol_name(enum pwm_protocol);
+double pwm_protocol_scale(enum pwm_protocol);
+double pwm_protocol_max_hz(enum pwm_protocol);
+
+void setup_pwm(struct pwm*, int);
+
+void set_pwm_trim(struct pwm*, double);
+double set_pwm_frequency(struct pwm*, double);
+double get_pwm_frequency(struct pwm*);
+double get_pwm_epoch(struct pwm*);
+void set_pwm_protocol(struct pwm*, enum pwm_protocol);
+void set_pwm(struct pwm*, int, int, int);
+void set_pwm_us(struct pwm*, int, int);
+void set_pwm_block(struct pwm*, int, const int*, int);
+void set_pwm_us_block(struct pwm*, int, const int*, int);
+void set_all_pwm(struct pwm*, int, int);
 
 #endif
@@ -0,0 +1,220 @@
+#include <math.h>
+
+#include "gyro.h"
+#include "quaternion.h"
+#include "fastmath.h"
+
+/*
+ * Hamilton product of two quaternions (rotation b followed by rotation a)
+ */
+struct quaternion quat_multiply(struct quaternion a, struct quaternion b) {
+	struct quaternion r;
+
+	r.q1 = a.q1 * b.q1 - a.q2 * b.q2 - a.q3 * b.q3 - a.q4 * b.q4;
+	r.q2 = a.q1 * b.q2 + a.q2 * b.q1 + a.q3 * b.q4 - a.q4 * b.q3;
+	r.q3 = a.q1 * b.q3 - a.q2 * b.q4 + a.q3 * b.q1 + a.q4 * b.q2;
+	r.q4 = a.q1 * b.q4 + a.q2 * b.q3 - a.q3 * b.q2 + a.q4 * b.q1;
+
+	return r;
+}
+
+/*
+ * Inverse of a unit quaternion
+ */
+struct quaternion quat_conjugate(struct quaternion q) {
+	q.q2 = -q.q2;
+	q.q3 = -q.q3;
+	q.q4 = -q.q4;
+
+	return q;
+}
+
+/*
+ * Scale a quaternion back to unit length.
+ *
+ * This stays on libm with FAST_MATH=1: fast_rsqrt() always lands slightly low, so the attitude would
+ * settle a few parts per million short of unit length and every consumer of it would be off by that.
+ */
+struct quaternion quat_normalise(struct quaternion q) {
+	double norm;
+
+	norm = sqrt(q.q1 * q.q1 + q.q2 * q.q2 + q.q3 * q.q3 + q.q4 * q.q4);
+	norm = 1.0 / norm;
+
+	q.q1 *= norm;
+	q.q2 *= norm;
+	q.q3 *= norm;
+	q.q4 *= norm;
+
+	return q;
+}
+
+/*
+ * Propagate an attitude by the body rates w (radians per second) over deltat seconds.
+ *
+ * This is a first order step and does not normalise the result, callers are expected to normalise
+ * once after a run of steps.
+ */
+struct quaternion quat_integrate(struct quaternion q, struct vec3 w, double deltat) {
+	struct quaternion r;
+
+	deltat *= 0.5;
+	r.q1 = q.q1 + (-q.q2 * w.x - q.q3 * w.y - q.q4 * w.z) * deltat;
+	r.q2 = q.q2 + (q.q1 * w.x + q.q3 * w.z - q.q4 * w.y) * deltat;
+	r.q3 = q.q3 + (q.q1 * w.y - q.q2 * w.z + q.q4 * w.x) * deltat;
+	r.q4 = q.q4 + (q.q1 * w.z + q.q2 * w.y - q.q3 * w.x) * deltat;
+
+	return r;
+}
+
+/*
+ * Get the attitude error between the current attitude and a target attitude as a rotation vector
+ * in degrees around the body axes.
+ *
+ * This uses the vector part of the error quaternion (2 * sin(angle / 2) * axis) which is equal to
+ * the axis-angle error for small angles and stays monotonic up to 180 degrees, so no trig is needed
+ * in the control loop.
+ */
+struct vec3 quat_error(struct quaternion q, struct quaternion target) {
+	struct quaternion e;
+	struct vec3 err;
+	double scale;
+
+	e = quat_multiply(quat_conjugate(target), q);
+
+	/* Take the shortest path around (q and -q are the same attitude) */
+	scale = (e.q1 < 0 ? -2.0 : 2.0) * 57.29577951;
+
+	err.x = e.q2 * scale;
+	err.y = e.q3 * scale;
+	err.z = e.q4 * scale;
+
+	return err;
+}
+
+/*
+ * Take a quaternion angle and convert it to a rotation matrix (body to earth frame)
+ */
+void quat_to_matrix(struct quaternion q, double r[3][3]) {
+	double q2q2 = q.q2 * q.q2;
+	double q3q3 = q.q3 * q.q3;
+	double q4q4 = q.q4 * q.q4;
+
+	r[0][0] = 1 - 2 * (q3q3 + q4q4);
+	r[0][1] = 2 * (q.q2 * q.q3 - q.q1 * q.q4);
+	r[0][2] = 2 * (q.q2 * q.q4 + q.q1 * q.q3);
+
+	r[1][0] = 2 * (q.q2 * q.q3 + q.q1 * q.q4);
+	r[1][1] = 1 - 2 * (q2q2 + q4q4);
+	r[1][2] = 2 * (q.q3 * q.q4 - q.q1 * q.q2);
+
+	r[2][0] = 2 * (q.q2 * q.q4 - q.q1 * q.q3);
+	r[2][1] = 2 * (q.q3 * q.q4 + q.q1 * q.q2);
+	r[2][2] = 1 - 2 * (q2q2 + q3q3);
+}
+
+/*
+ * Take a rotation matrix (body to earth frame) and convert it to a quaternion
+ *
+ * Uses the largest of the four possible square roots so it stays accurate near 180 degrees.
+ */
+struct quaternion quat_from_matrix(double r[3][3]) {
+	struct quaternion q;
+	double trace, s;
+
+	trace = r[0][0] + r[1][1] + r[2][2];
+
+	if(trace > 0) {
+		s = 2.0 * sqrt(1.0 + trace);
+		q.q1 = 0.25 * s;
+		q.q2 = (r[2][1] - r[1][2]) / s;
+		q.q3 = (r[0][2] - r[2][0]) / s;
+		q.q4 = (r[1][0] - r[0][1]) / s;
+	} else if(r[0][0] > r[1][1] && r[0][0] > r[2][2]) {
+		s = 2.0 * sqrt(1.0 + r[0][0] - r[1][1] - r[2][2]);
+		q.q1 = (r[2][1] - r[1][2]) / s;
+		q.q2 = 0.25 * s;
+		q.q3 = (r[0][1] + r[1][0]) / s;
+		q.q4 = (r[0][2] + r[2][0]) / s;
+	} else if(r[1][1] > r[2][2]) {
+		s = 2.0 * sqrt(1.0 + r[1][1] - r[0][0] - r[2][2]);
+		q.q1 = (r[0][2] - r[2][0]) / s;
+		q.q2 = (r[0][1] + r[1][0]) / s;
+		q.q3 = 0.25 * s;
+		q.q4 = (r[1][2] + r[2][1]) / s;
+	} else {
+		s = 2.0 * sqrt(1.0 + r[2][2] - r[0][0] - r[1][1]);
+		q.q1 = (r[1][0] - r[0][1]) / s;
+		q.q2 = (r[0][2] + r[2][0]) / s;
+		q.q3 = (r[1][2] + r[2][1]) / s;
+		q.q4 = 0.25 * s;
+	}
+
+	if(q.q1 < 0) {
+		q.q1 = -q.q1;
+		q.q2 = -q.q2;
+		q.q3 = -q.q3;
+		q.q4 = -q.q4;
+	}
+
+	return quat_normalise(q);
+}
+
+/*
+ * Take a quaternion angle and convert it to a 3D heading euler angle
+ *
+ * This is expensive (two atan2 and an asin, approximated with FAST_MATH=1) so it should only be
+ * used for displaying the attitude, never in the real time loop.
+ */
+struct vec3 quat_to_euler(struct quaternion q) {
+	struct vec3 dir;
+	double temp1, temp2;
+
+	/* Modified from https://en.wikipedia.org/wiki/Conversion_between_quaternions_and_Euler_angles */
+
+	temp1 = 2 * (q.q1 * q.q2 + q.q3 * q.q4);
+	temp2 = 1 - 2 * (q.q2 * q.q2 + q.q3 * q.q3);
+	dir.x = ATAN2(temp1, temp2);
+
+	temp1 = 2 * (q.q1 * q.q3 - q.q4 * q.q2);
+	if(fabs(temp1) >= 1) {
+		dir.y = copysign(M_PI / 2, temp1);
+	} else { 
+		dir.y = ASIN(temp1);
+	}
+
+	temp1 = 2 * (q.q1 * q.q4 + q.q2 * q.q3);
+	temp2 = 1 - 2 * (q.q3 * q.q3 + q.q4 * q.q4);
+	dir.z = ATAN2(temp1, temp2);
+
+	/* Convert back to degrees */
+
+	dir.x *= 57.29577951;
+	dir.y *= 57.29577951;
+	dir.z *= 57.29577951;
+
+	return dir;
+}
+
+/*
+ * Build the attitude quaternion for euler angles in degrees (roll, pitch, yaw applied yaw first),
+ * the inverse of quat_to_euler()
+ */
+struct quaternion quat_from_euler(struct vec3 dir) {
+	struct quaternion q;
+	double cr, sr, cp, sp, cy, sy;
+
+	cr = cos(dir.x * 0.5 / 57.29577951);
+	sr = sin(dir.x * 0.5 / 57.29577951);
+	cp = cos(dir.y * 0.5 / 57.29577951);
+	sp = sin(dir.y * 0.5 / 57.29577951);
+	cy = cos(dir.z * 0.5 / 57.29577951);
+	sy = sin(dir.z * 0.5 / 57.29577951);
+
+	q.q1 = cr * cp * cy + sr * sp * sy;
+	q.q2 = sr * cp * cy - cr * sp * sy;
+	q.q3 = cr * sp * cy + sr * cp * sy;
+	q.q4 = cr * cp * sy - sr * sp * cy;
+
+	return q;
+}
@@ -0,0 +1,32 @@
+#include "gyro.h"
+
+/*
+ * Quaternion helpers for representing the attitude of the air craft.
+ *
+ * The scalar part is stored in q1 and the vector part in q2, q3 and q4, matching the ordering used
+ * by the Madgwick filter.
+ */
+
+#ifndef _QUATERNION_H
+#define _QUATERNION_H
+
+struct quaternion {
+	double q1;
+	double q2;
+	double q3;
+	double q4;
+};
+
+static const struct quaternion QUAT_IDENTITY = { 1, 0, 0, 0 };
+
+struct quaternion quat_multiply(struct quaternion, struct quaternion);
+struct quaternion quat_conjugate(struct quaternion);
+struct quaternion quat_normalise(struct quaternion);
+struct quaternion quat_integrate(struct quaternion, struct vec3, double);
+struct vec3 quat_error(struct quaternion, struct quaternion);
+void quat_to_matrix(struct quaternion, double[3][3]);
+struct quaternion quat_from_matrix(double[3][3]);
+struct vec3 quat_to_euler(struct quaternion);
+struct quaternion quat_from_euler(struct vec3);
+
+#endif
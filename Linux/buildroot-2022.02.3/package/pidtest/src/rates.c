@@ -0,0 +1,104 @@
+#include <string.h>
+
+#include "rates.h"
+
+static const char* TASK_NAMES[TASK_COUNT] = {
+	[TASK_MAG] = "magnetometer",
+	[TASK_FUSION] = "fusion",
+	[TASK_ACCEL] = "accelerometer",
+	[TASK_ANGLE] = "angle loop",
+	[TASK_TELEMETRY] = "telemetry"
+};
+
+/*
+ * Relative cost of each task, only the order and the ratios matter.  These are placeholders that
+ * follow the bus transfers of each task (a magnetometer read is the longest, telemetry only copies
+ * a struct), none of them has been timed on the board.  Until they are, the stagger only keeps the
+ * tasks apart and doesn't balance the ticks by real cost.
+ */
+static const int TASK_COST[TASK_COUNT] = {
+	[TASK_MAG] = 8,
+	[TASK_FUSION] = 6,
+	[TASK_ACCEL] = 4,
+	[TASK_ANGLE] = 2,
+	[TASK_TELEMETRY] = 1
+};
+
+const char* rate_task_name(enum rate_task task) {
+	return TASK_NAMES[task];
+}
+
+/*
+ * Every task on every tick
+ */
+void rate_plan_init(struct rate_plan* p) {
+	int i;
+
+	for(i = 0; i < TASK_COUNT; i++) {
+		p->divisor[i] = 1;
+		p->offset[i] = 0;
+	}
+}
+
+static int gcd(int a, int b) {
+	int t;
+
+	while(b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+/*
+ * Pick the offset of every task, the tasks are in order of cost in enum rate_task.  Each one goes
+ * where the most expensive tick it lands on is the cheapest, which is exact for the usual divisors
+ * and a good spread otherwise.
+ */
+void rate_plan_stagger(struct rate_plan* p) {
+	int load[RATE_MAX_PATTERN];
+	int pattern, task, offset, best, best_peak, peak, t;
+
+	pattern = 1;
+	for(task = 0; task < TASK_COUNT; task++) {
+		pattern = pattern / gcd(pattern, p->divisor[task]) * p->divisor[task];
+		if(pattern > RATE_MAX_PATTERN) {
+			pattern = RATE_MAX_PATTERN;
+		}
+	}
+
+	memset(load, 0, sizeof(load));
+
+	for(task = 0; task < TASK_COUNT; task++) {
+		best = 0;
+		best_peak = -1;
+
+		for(offset = 0; offset < p->divisor[task]; offset++) {
+			peak = 0;
+			for(t = offset; t < pattern; t += p->divisor[task]) {
+				if(load[t] > peak) {
+					peak = load[t];
+				}
+			}
+
+			if(best_peak < 0 || peak < best_peak) {
+				best = offset;
+				best_peak = peak;
+			}
+		}
+
+		p->offset[task] = best;
+		for(t = best; t < pattern; t += p->divisor[task]) {
+			load[t] += TASK_COST[task];
+		}
+	}
+}
+
+/*
+ * Whether a task runs on a tick
+ */
+int rate_due(const struct rate_plan* p, enum rate_task task, unsigned long tick) {
+	return tick % p->divisor[task] == (unsigned long)p->offset[task];
+}
@@ -0,0 +1,36 @@
+/*
+ * Multi-rate schedule of the real time loop.
+ *
+ * The loop ticks at the gyroscope rate and the inner rate loop runs on every tick.  Everything else
+ * is a task that runs every divisor ticks, and each task gets an offset inside its period so that
+ * tasks on different rates are spread over the ticks instead of all landing on tick 0.  The offsets
+ * are picked once at startup, most expensive task first, so the costliest tick over the whole
+ * pattern is as cheap as it can be made.
+ */
+
+#ifndef _RATES_H
+#define _RATES_H
+
+#define RATE_MAX_PATTERN 5040 /* Longest repeating pattern of ticks that is searched when staggering */
+
+enum rate_task {
+	TASK_MAG,        /* Magnetometer read, the slowest bus transfer */
+	TASK_FUSION,     /* Accelerometer / magnetometer correction of the estimator */
+	TASK_ACCEL,      /* Accelerometer read */
+	TASK_ANGLE,      /* Outer attitude loop */
+	TASK_TELEMETRY,  /* Publishing to the telemetry thread */
+	TASK_COUNT
+};
+
+struct rate_plan {
+	int divisor[TASK_COUNT];
+	int offset[TASK_COUNT];
+};
+
+const char* rate_task_name(enum rate_task);
+
+void rate_plan_init(struct rate_plan*);
+void rate_plan_stagger(struct rate_plan*);
+int rate_due(const struct rate_plan*, enum rate_task, unsigned long);
+
+#endif
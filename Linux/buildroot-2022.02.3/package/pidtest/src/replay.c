@@ -0,0 +1,282 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gyro.h"
+#include "quaternion.h"
+#include "estimator.h"
+#include "replaylog.h"
+#include "timing.h"
+
+/*
+ * Offline replay tool that runs every attitude estimator over the same sensor data and reports
+ * how long an update takes and how far the estimated attitude is from the truth.  This is meant
+ * to be built and run on the host (make replay) or on the target to pick the cheapest estimator
+ * that fits in the attitude error budget at a given loop rate.
+ *
+ * Logs use the CSV format described in replaylog.h.  When a log has no true attitude the
+ * estimators are compared against the Madgwick filter instead.  Without a log file the data is
+ * simulated.
+ *
+ * With -k the estimators are also run through the batched update in bursts of IMU_BATCH_MAX
+ * samples, fusing the accelerometer every stride samples.
+ */
+
+static const double DEFAULT_RATE = 500.0;    /* Simulated loop rate in Hz */
+static const double DEFAULT_SECONDS = 60.0;  /* Length of the simulated run */
+static const double DEFAULT_BUDGET = 2.0;    /* Attitude error budget in degrees */
+static const double SETTLE_TIME = 5.0;       /* Time to let the filters converge before scoring */
+static const double MIN_BENCH_TIME = 0.25;   /* Time to spend benchmarking each estimator */
+
+struct result {
+	double ns_per_update;
+	double rms_error;
+	double max_error;
+};
+
+/*
+ * Run one estimator over the samples, scoring it against the reference attitudes
+ */
+static struct result run(enum estimator_type type, const struct sample* samples, const struct quaternion* reference, int n) {
+	struct estimator est;
+	struct quaternion q;
+	struct result res;
+	double start, elapsed, dt, error, sum;
+	int i, passes, scored;
+
+	/* Accuracy pass */
+	estimator_init(&est, type);
+	sum = 0.0;
+	scored = 0;
+	res.max_error = 0.0;
+
+	for(i = 1; i < n; i++) {
+		dt = samples[i].t - samples[i - 1].t;
+		q = get_attitude(&est, samples[i].w, samples[i].a, samples[i].m, dt);
+
+		if(samples[i].t - samples[0].t >= SETTLE_TIME) {
+			error = attitude_distance(q, reference[i]);
+			sum += error * error;
+			scored++;
+			if(error > res.max_error) {
+				res.max_error = error;
+			}
+		}
+	}
+
+	res.rms_error = scored > 0 ? sqrt(sum / scored) : 0.0;
+
+	/* Timing pass, repeated until the measurement is long enough to trust */
+	passes = 0;
+	start = now();
+	do {
+		estimator_init(&est, type);
+		for(i = 1; i < n; i++) {
+			get_attitude(&est, samples[i].w, samples[i].a, samples[i].m, samples[i].t - samples[i - 1].t);
+		}
+		passes++;
+		elapsed = now() - start;
+	} while(elapsed < MIN_BENCH_TIME);
+
+	res.ns_per_update = elapsed * 1000000000.0 / ((double)passes * (n - 1));
+
+	return res;
+}
+
+/*
+ * Split the samples into bursts like the ones drained from the sensor FIFO
+ */
+static struct imu_batch* make_batches(const struct sample* samples, int n, int* count) {
+	struct imu_batch* batches;
+	struct imu_batch* b;
+	int i, j;
+
+	*count = (n + IMU_BATCH_MAX - 1) / IMU_BATCH_MAX;
+	batches = malloc(*count * sizeof(struct imu_batch));
+	if(batches == NULL) {
+		printf("Failed to allocate the sample batches\r\n");
+		exit(1);
+	}
+
+	for(i = 0; i < *count; i++) {
+		b = &batches[i];
+		b->count = 0;
+		for(j = i * IMU_BATCH_MAX; j < n && b->count < IMU_BATCH_MAX; j++) {
+			b->t[b->count] = samples[j].t;
+			b->wx[b->count] = samples[j].w.x;
+			b->wy[b->count] = samples[j].w.y;
+			b->wz[b->count] = samples[j].w.z;
+			b->ax[b->count] = samples[j].a.x;
+			b->ay[b->count] = samples[j].a.y;
+			b->az[b->count] = samples[j].a.z;
+			b->count++;
+		}
+	}
+
+	return batches;
+}
+
+/*
+ * Run one estimator over the samples in batches, scoring it at the end of every batch
+ */
+static struct result run_batched(enum estimator_type type, const struct sample* samples, const struct quaternion* reference,
+		const struct imu_batch* batches, int count, int n, int stride) {
+	struct estimator est;
+	struct quaternion q;
+	struct result res;
+	double start, elapsed, error, sum;
+	int i, last, passes, scored;
+
+	/* Accuracy pass */
+	estimator_init(&est, type);
+	sum = 0.0;
+	scored = 0;
+	res.max_error = 0.0;
+
+	for(i = 0; i < count; i++) {
+		last = i * IMU_BATCH_MAX + batches[i].count - 1;
+		q = get_attitude_batch(&est, &batches[i], samples[last].m, stride);
+
+		if(samples[last].t - samples[0].t >= SETTLE_TIME) {
+			error = attitude_distance(q, reference[last]);
+			sum += error * error;
+			scored++;
+			if(error > res.max_error) {
+				res.max_error = error;
+			}
+		}
+	}
+
+	res.rms_error = scored > 0 ? sqrt(sum / scored) : 0.0;
+
+	/* Timing pass */
+	passes = 0;
+	start = now();
+	do {
+		estimator_init(&est, type);
+		for(i = 0; i < count; i++) {
+			last = i * IMU_BATCH_MAX + batches[i].count - 1;
+			get_attitude_batch(&est, &batches[i], samples[last].m, stride);
+		}
+		passes++;
+		elapsed = now() - start;
+	} while(elapsed < MIN_BENCH_TIME);
+
+	res.ns_per_update = elapsed * 1000000000.0 / ((double)passes * n);
+
+	return res;
+}
+
+int main(int argc, char** argv) {
+	struct sample* samples;
+	struct quaternion* reference;
+	struct estimator est;
+	struct imu_batch* batches;
+	struct result results[ESTIMATOR_COUNT];
+	struct result batched;
+	double rate, seconds, budget;
+	int i, n, opt, has_truth, best, stride, count;
+
+	rate = DEFAULT_RATE;
+	seconds = DEFAULT_SECONDS;
+	budget = DEFAULT_BUDGET;
+	stride = -1;
+
+	while((opt = getopt(argc, argv, "r:s:b:k:")) != -1) {
+		switch(opt) {
+		case 'r': /* Simulated loop rate in Hz */
+			rate = atof(optarg);
+			break;
+		case 's': /* Simulated run length in seconds */
+			seconds = atof(optarg);
+			break;
+		case 'b': /* Attitude error budget in degrees */
+			budget = atof(optarg);
+			break;
+		case 'k': /* Accelerometer fusion stride for the batched update */
+			stride = atoi(optarg);
+			break;
+		default:
+			printf("Usage: %s [-r rate] [-s seconds] [-b budget] [-k stride] [log.csv]\r\n", argv[0]);
+			exit(1);
+		}
+	}
+
+	if(optind < argc) {
+		samples = load_log(argv[optind], &n, &has_truth);
+		if(samples == NULL) {
+			printf("Failed to open the log %s\r\n", argv[optind]);
+			exit(1);
+		}
+		printf("Replaying %d samples from %s\r\n", n, argv[optind]);
+	} else {
+		samples = simulate(rate, seconds, 1, &n);
+		has_truth = 1;
+		printf("Replaying %d simulated samples at %.0f Hz\r\n", n, rate);
+	}
+
+	if(n < 2) {
+		printf("Not enough samples to replay\r\n");
+		exit(1);
+	}
+
+	reference = malloc(n * sizeof(struct quaternion));
+	if(reference == NULL) {
+		printf("Failed to allocate the reference attitudes\r\n");
+		exit(1);
+	}
+
+	if(has_truth) {
+		for(i = 0; i < n; i++) {
+			reference[i] = samples[i].truth;
+		}
+	} else {
+		printf("The log has no true attitude, comparing against %s\r\n", estimator_name(ESTIMATOR_MADGWICK));
+		estimator_init(&est, ESTIMATOR_MADGWICK);
+		reference[0] = QUAT_IDENTITY;
+		for(i = 1; i < n; i++) {
+			reference[i] = get_attitude(&est, samples[i].w, samples[i].a, samples[i].m, samples[i].t - samples[i - 1].t);
+		}
+	}
+
+	printf("%-10s %12s %12s %12s\r\n", "estimator", "ns/update", "rms (deg)", "max (deg)");
+
+	best = -1;
+	for(i = 0; i < ESTIMATOR_COUNT; i++) {
+		results[i] = run(i, samples, reference, n);
+		printf("%-10s %12.1f %12.3f %12.3f\r\n", estimator_name(i),
+			results[i].ns_per_update, results[i].rms_error, results[i].max_error);
+
+		if(results[i].rms_error <= budget && (best < 0 || results[i].ns_per_update < results[best].ns_per_update)) {
+			best = i;
+		}
+	}
+
+	if(stride >= 0) {
+		batches = make_batches(samples, n, &count);
+
+		printf("Batched update, %d samples per batch, fusing every %d samples:\r\n", IMU_BATCH_MAX,
+			stride > 0 ? stride : IMU_BATCH_MAX);
+		for(i = 0; i < ESTIMATOR_COUNT; i++) {
+			batched = run_batched(i, samples, reference, batches, count, n, stride);
+			printf("%-10s %12.1f %12.3f %12.3f\r\n", estimator_name(i),
+				batched.ns_per_update, batched.rms_error, batched.max_error);
+		}
+
+		free(batches);
+	}
+
+	if(best < 0) {
+		printf("No estimator meets the %.2f degree budget\r\n", budget);
+	} else {
+		printf("Cheapest estimator within the %.2f degree budget: %s\r\n", budget, estimator_name(best));
+	}
+
+	free(reference);
+	free(samples);
+
+	return 0;
+}
@@ -0,0 +1,182 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gyro.h"
+#include "quaternion.h"
+#include "replaylog.h"
+
+/*
+ * Get a normally distributed random number (Box-Muller)
+ */
+static double randn(void) {
+	double u1, u2;
+
+	do {
+		u1 = drand48();
+	} while(u1 <= 0.0);
+	u2 = drand48();
+
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+/*
+ * Rotate an earth frame vector into the sensor frame of the attitude q
+ */
+static struct vec3 to_sensor_frame(struct quaternion q, struct vec3 v) {
+	double r[3][3];
+	struct vec3 s;
+
+	quat_to_matrix(q, r);
+
+	s.x = r[0][0] * v.x + r[1][0] * v.y + r[2][0] * v.z;
+	s.y = r[0][1] * v.x + r[1][1] * v.y + r[2][1] * v.z;
+	s.z = r[0][2] * v.x + r[1][2] * v.y + r[2][2] * v.z;
+
+	return s;
+}
+
+/*
+ * Simulate a wobbling air craft with noisy, biased sensors
+ */
+struct sample* simulate(double rate, double seconds, long seed, int* count) {
+	struct sample* samples;
+	struct quaternion q, dq;
+	struct vec3 w, rad, phase;
+	double dt, t, angle, norm;
+	int i, n;
+
+	const struct vec3 gravity = { 0.0, 0.0, 1.0 };  /* g */
+	const struct vec3 field = { 20.0, 0.0, 43.0 };  /* uT, roughly mid latitude */
+	const struct vec3 bias = { 0.5, -0.3, 0.2 };    /* deg/s */
+	const double GYRO_NOISE = 0.3;                  /* deg/s */
+	const double ACCEL_NOISE = 0.01;                /* g */
+	const double MAG_NOISE = 0.5;                   /* uT */
+
+	dt = 1.0 / rate;
+	n = (int)(seconds * rate);
+	samples = malloc(n * sizeof(struct sample));
+	if(samples == NULL) {
+		printf("Failed to allocate the simulated samples\r\n");
+		exit(1);
+	}
+
+	srand48(seed);
+	q = QUAT_IDENTITY;
+
+	/* Every seed wobbles a bit differently */
+	phase.x = 2.0 * M_PI * drand48();
+	phase.y = 2.0 * M_PI * drand48();
+	phase.z = 2.0 * M_PI * drand48();
+
+	for(i = 0; i < n; i++) {
+		t = i * dt;
+
+		/* True body rates in degrees per second */
+		w.x = 40.0 * sin(2.0 * M_PI * 0.31 * t + phase.x);
+		w.y = 30.0 * sin(2.0 * M_PI * 0.47 * t + phase.y);
+		w.z = 20.0 * sin(2.0 * M_PI * 0.13 * t + phase.z);
+
+		samples[i].t = t;
+		samples[i].truth = q;
+		samples[i].w.x = w.x + bias.x + GYRO_NOISE * randn();
+		samples[i].w.y = w.y + bias.y + GYRO_NOISE * randn();
+		samples[i].w.z = w.z + bias.z + GYRO_NOISE * randn();
+
+		samples[i].a = to_sensor_frame(q, gravity);
+		samples[i].a.x += ACCEL_NOISE * randn();
+		samples[i].a.y += ACCEL_NOISE * randn();
+		samples[i].a.z += ACCEL_NOISE * randn();
+
+		samples[i].m = to_sensor_frame(q, field);
+		samples[i].m.x += MAG_NOISE * randn();
+		samples[i].m.y += MAG_NOISE * randn();
+		samples[i].m.z += MAG_NOISE * randn();
+
+		/* Integrate the true attitude exactly over the step */
+		rad.x = w.x * 0.017453292519943295;
+		rad.y = w.y * 0.017453292519943295;
+		rad.z = w.z * 0.017453292519943295;
+		norm = sqrt(rad.x * rad.x + rad.y * rad.y + rad.z * rad.z);
+		angle = norm * dt;
+		if(norm > 0.0) {
+			dq.q1 = cos(angle / 2.0);
+			dq.q2 = sin(angle / 2.0) * rad.x / norm;
+			dq.q3 = sin(angle / 2.0) * rad.y / norm;
+			dq.q4 = sin(angle / 2.0) * rad.z / norm;
+			q = quat_multiply(q, dq);
+		}
+	}
+
+	*count = n;
+
+	return samples;
+}
+
+/*
+ * Load a recorded log, returns NULL if it can't be read
+ */
+struct sample* load_log(const char* path, int* count, int* has_truth) {
+	FILE* file;
+	struct sample* samples;
+	struct sample s;
+	char line[512];
+	int n, capacity, fields;
+
+	file = fopen(path, "r");
+	if(file == NULL) {
+		return NULL;
+	}
+
+	n = 0;
+	capacity = 4096;
+	samples = malloc(capacity * sizeof(struct sample));
+	*has_truth = 1;
+
+	while(samples != NULL && fgets(line, sizeof(line), file) != NULL) {
+		fields = sscanf(line, "%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf",
+			&s.t, &s.w.x, &s.w.y, &s.w.z, &s.a.x, &s.a.y, &s.a.z, &s.m.x, &s.m.y, &s.m.z,
+			&s.truth.q1, &s.truth.q2, &s.truth.q3, &s.truth.q4);
+
+		if(fields < 10) {
+			continue; /* Header or junk */
+		}
+		if(fields < 14) {
+			*has_truth = 0;
+		}
+
+		if(n == capacity) {
+			capacity *= 2;
+			samples = realloc(samples, capacity * sizeof(struct sample));
+			if(samples == NULL) {
+				break;
+			}
+		}
+		samples[n++] = s;
+	}
+
+	fclose(file);
+
+	if(samples == NULL) {
+		printf("Failed to allocate the log samples\r\n");
+		exit(1);
+	}
+
+	*count = n;
+
+	return samples;
+}
+
+/*
+ * Angle in degrees of the rotation between two attitudes
+ */
+double attitude_distance(struct quaternion a, struct quaternion b) {
+	double dot;
+
+	dot = fabs(a.q1 * b.q1 + a.q2 * b.q2 + a.q3 * b.q3 + a.q4 * b.q4);
+	if(dot > 1.0) {
+		dot = 1.0;
+	}
+
+	return 2.0 * acos(dot) * 57.29577951;
+}
@@ -0,0 +1,30 @@
+#include "gyro.h"
+#include "quaternion.h"
+
+/*
+ * Sensor logs for the offline replay tools.
+ *
+ * Logs are CSV files with one sample per line in the same units as gyro.c:
+ *
+ * t,wx,wy,wz,ax,ay,az,mx,my,mz[,q1,q2,q3,q4]
+ *
+ * Time is in seconds, the gyro in degrees per second, the accelerometer in g and the magnetometer
+ * in uT.  The optional quaternion is the true attitude.
+ */
+
+#ifndef _REPLAYLOG_H
+#define _REPLAYLOG_H
+
+struct sample {
+	double t;
+	struct vec3 w;
+	struct vec3 a;
+	struct vec3 m;
+	struct quaternion truth;
+};
+
+struct sample* simulate(double, double, long, int*);
+struct sample* load_log(const char*, int*, int*);
+double attitude_distance(struct quaternion, struct quaternion);
+
+#endif
@@ -0,0 +1,176 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "control.h"
+#include "schedule.h"
+
+/*
+ * Read a schedule file, returns NULL (after saying why) if it can't be used
+ */
+struct gain_schedule* schedule_load(const char* path) {
+	struct gain_schedule* s;
+	char line[256], kind[16];
+	double g[CONTROL_AXES][3];
+	double x, y;
+	FILE* file;
+	int number, axis, n;
+
+	file = fopen(path, "r");
+	if(file == NULL) {
+		printf("Failed to open the gain schedule %s\r\n", path);
+		return NULL;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if(s == NULL) {
+		printf("Failed to allocate the gain schedule\r\n");
+		fclose(file);
+		return NULL;
+	}
+
+	number = 0;
+	while(fgets(line, sizeof(line), file) != NULL) {
+		number++;
+		if(line[0] == '#' || line[0] == '\n' || line[0] == '\r') {
+			continue;
+		}
+
+		if(sscanf(line, "%15s", kind) != 1) {
+			continue;
+		}
+
+		if(strcmp(kind, "throttle") == 0) {
+			n = sscanf(line, "%*s %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf", &x,
+				&g[0][0], &g[0][1], &g[0][2], &g[1][0], &g[1][1], &g[1][2], &g[2][0], &g[2][1], &g[2][2]);
+			if(n != 10 || s->points >= SCHEDULE_POINTS || (s->points > 0 && x <= s->throttle[s->points - 1])) {
+				goto invalid;
+			}
+
+			s->throttle[s->points] = x;
+			for(axis = 0; axis < CONTROL_AXES; axis++) {
+				memcpy(s->gains[s->points][axis], g[axis], sizeof(g[axis]));
+			}
+			s->points++;
+		} else if(strcmp(kind, "voltage") == 0) {
+			n = sscanf(line, "%*s %lf %lf", &x, &y);
+			if(n != 2 || s->voltages >= SCHEDULE_VOLTAGES || (s->voltages > 0 && x <= s->voltage[s->voltages - 1])) {
+				goto invalid;
+			}
+
+			s->voltage[s->voltages] = x;
+			s->factor[s->voltages] = y;
+			s->voltages++;
+		} else {
+			goto invalid;
+		}
+	}
+
+	fclose(file);
+
+	if(s->points == 0) {
+		printf("The gain schedule %s has no throttle breakpoints\r\n", path);
+		free(s);
+		return NULL;
+	}
+
+	return s;
+
+invalid:
+	printf("Invalid line %d in the gain schedule %s\r\n", number, path);
+	fclose(file);
+	free(s);
+	return NULL;
+}
+
+void schedule_slot_init(struct schedule_slot* slot) {
+	atomic_init(&slot->current, NULL);
+	atomic_init(&slot->epoch, 0);
+}
+
+/*
+ * Swap in a new schedule (or NULL to go back to fixed gains) and free the old one once the real
+ * time loop is done with it.  Must not be called from the real time loop.
+ */
+void schedule_publish(struct schedule_slot* slot, struct gain_schedule* s) {
+	struct gain_schedule* old;
+	unsigned long epoch;
+	int waited;
+
+	old = atomic_exchange_explicit(&slot->current, s, memory_order_acq_rel);
+	if(old == NULL) {
+		return;
+	}
+
+	/* Any use of the old schedule started before the swap ends with a bump of the epoch */
+	epoch = atomic_load_explicit(&slot->epoch, memory_order_acquire);
+	for(waited = 0; waited < SCHEDULE_GRACE_US; waited += 1000) {
+		if(atomic_load_explicit(&slot->epoch, memory_order_acquire) != epoch) {
+			free(old);
+			return;
+		}
+		usleep(1000);
+	}
+
+	/* The loop isn't running, it may still hold the pointer when it comes back so keep it */
+}
+
+/*
+ * Find the segment of the n increasing breakpoints x that at is in and how far along it (0 to 1) it
+ * is, past the ends the first or last value is held
+ */
+static int segment(const double* x, int n, double at, double* t) {
+	int i;
+
+	if(n == 1 || at <= x[0]) {
+		*t = 0.0;
+		return 0;
+	}
+	if(at >= x[n - 1]) {
+		*t = 1.0;
+		return n - 2;
+	}
+
+	for(i = 0; i < n - 2 && at > x[i + 1]; i++);
+
+	*t = (at - x[i]) / (x[i + 1] - x[i]);
+
+	return i;
+}
+
+static double lerp(double a, double b, double t) {
+	return a + t * (b - a);
+}
+
+/*
+ * Set the rate loop gains of the controller for the throttle (us) and battery voltage (V, 0 if it
+ * isn't known).  Called from the real time loop, does nothing without a schedule.  The integral is
+ * stored already multiplied by ki so changing ki doesn't make the output jump.
+ */
+void schedule_apply(struct schedule_slot* slot, double throttle, double voltage, struct controller* c) {
+	struct gain_schedule* s;
+	double t, factor;
+	int i, axis, next;
+
+	s = atomic_load_explicit(&slot->current, memory_order_acquire);
+	if(s != NULL) {
+		factor = 1.0;
+		if(s->voltages > 0 && voltage > 0.0) {
+			i = segment(s->voltage, s->voltages, voltage, &t);
+			next = s->voltages > 1 ? i + 1 : i;
+			factor = lerp(s->factor[i], s->factor[next], t);
+		}
+
+		i = segment(s->throttle, s->points, throttle, &t);
+		next = s->points > 1 ? i + 1 : i;
+		for(axis = 0; axis < CONTROL_AXES; axis++) {
+			c->rate[axis].gains.kp = factor * lerp(s->gains[i][axis][0], s->gains[next][axis][0], t);
+			c->rate[axis].gains.ki = factor * lerp(s->gains[i][axis][1], s->gains[next][axis][1], t);
+			c->rate[axis].gains.kd = factor * lerp(s->gains[i][axis][2], s->gains[next][axis][2], t);
+		}
+	}
+
+	atomic_fetch_add_explicit(&slot->epoch, 1, memory_order_release);
+}
@@ -0,0 +1,50 @@
+#include <stdatomic.h>
+
+#include "control.h"
+
+/*
+ * Throttle indexed gain scheduling for the rate loop.
+ *
+ * Thrust isn't linear in the pulse width so the loop gain of the air craft changes with throttle,
+ * and it drops further as the battery sags.  A schedule holds the rate loop gains of every axis at a
+ * few throttle breakpoints, the loop interpolates linearly between them and multiplies by an
+ * optional factor interpolated from the battery voltage.
+ *
+ * Schedules are read from a text file:
+ *
+ * throttle <us> <roll kp ki kd> <pitch kp ki kd> <yaw kp ki kd>
+ * voltage <V> <gain factor>
+ *
+ * with the breakpoints in increasing order.  A new schedule is swapped in at run time by replacing
+ * one atomic pointer, the real time loop never waits for it.  The old one is freed once the loop has
+ * been seen to go around after the swap.
+ */
+
+#ifndef _SCHEDULE_H
+#define _SCHEDULE_H
+
+#define SCHEDULE_POINTS 8
+#define SCHEDULE_VOLTAGES 4
+
+static const int SCHEDULE_GRACE_US = 1000000; /* Longest wait for the loop before an old schedule is leaked */
+
+struct gain_schedule {
+	int points;
+	double throttle[SCHEDULE_POINTS];
+	double gains[SCHEDULE_POINTS][CONTROL_AXES][3]; /* kp, ki, kd */
+	int voltages;
+	double voltage[SCHEDULE_VOLTAGES];
+	double factor[SCHEDULE_VOLTAGES];
+};
+
+struct schedule_slot {
+	_Atomic(struct gain_schedule*) current;
+	atomic_ulong epoch; /* Bumped by the real time loop after every use of current */
+};
+
+struct gain_schedule* schedule_load(const char*);
+void schedule_slot_init(struct schedule_slot*);
+void schedule_publish(struct schedule_slot*, struct gain_schedule*);
+void schedule_apply(struct schedule_slot*, double, double, struct controller*);
+
+#endif
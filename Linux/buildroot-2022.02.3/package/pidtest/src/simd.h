@@ -0,0 +1,65 @@
+/*
+ * Minimal SIMD abstraction for the offline replay tools.
+ *
+ * A vfloat holds one value for each of SIMD_LANES independent filter instances.  The arithmetic
+ * uses the GCC vector extensions so the same code compiles to NEON on the 64 bit Pi 3/4 boards and
+ * SSE or AVX on the host, only the square root needs an instruction set specific intrinsic.
+ */
+
+#ifndef _SIMD_H
+#define _SIMD_H
+
+#include <math.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_LANES 8
+#define SIMD_NAME "AVX"
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define SIMD_LANES 4
+#define SIMD_NAME "SSE"
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SIMD_LANES 4
+#define SIMD_NAME "NEON"
+#else
+#define SIMD_LANES 4
+#define SIMD_NAME "generic"
+#endif
+
+typedef float vfloat __attribute__((vector_size(SIMD_LANES * sizeof(float))));
+
+/*
+ * Set every lane to the same value
+ */
+static inline vfloat v_set1(float x) {
+	vfloat v;
+	int i;
+
+	for(i = 0; i < SIMD_LANES; i++) {
+		v[i] = x;
+	}
+
+	return v;
+}
+
+static inline vfloat v_sqrt(vfloat v) {
+#if defined(__AVX__)
+	return (vfloat)_mm256_sqrt_ps((__m256)v);
+#elif defined(__SSE__)
+	return (vfloat)_mm_sqrt_ps((__m128)v);
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+	return (vfloat)vsqrtq_f32((float32x4_t)v);
+#else
+	int i;
+
+	for(i = 0; i < SIMD_LANES; i++) {
+		v[i] = sqrtf(v[i]);
+	}
+
+	return v;
+#endif
+}
+
+#endif
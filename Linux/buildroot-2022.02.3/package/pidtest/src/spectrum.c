@@ -0,0 +1,340 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "gyro.h"
+#include "filter.h"
+#include "spectrum.h"
+
+/*
+ * Coefficients of a biquad that passes everything through untouched
+ */
+static void passthrough(struct biquad_coeffs* c) {
+	c->b0 = 1.0;
+	c->b1 = 0.0;
+	c->b2 = 0.0;
+	c->a1 = 0.0;
+	c->a2 = 0.0;
+}
+
+/*
+ * Set up the analyser for samples pushed at loop_rate (Hz), averaging every decimation of them
+ */
+void spectrum_init(struct spectrum* s, double loop_rate, int decimation) {
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	s->rate = loop_rate / decimation;
+	s->decimation = decimation;
+
+	for(i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+		s->window[i] = 0.5 * (1.0 - cos(2.0 * M_PI * i / (SPECTRUM_FFT_SIZE - 1)));
+	}
+
+	for(i = 0; i < SPECTRUM_FFT_SIZE / 2; i++) {
+		s->twiddle_re[i] = cos(-2.0 * M_PI * i / SPECTRUM_FFT_SIZE);
+		s->twiddle_im[i] = sin(-2.0 * M_PI * i / SPECTRUM_FFT_SIZE);
+	}
+
+	for(i = 0; i < SPECTRUM_NOTCHES; i++) {
+		passthrough(&s->result.notch[i]);
+	}
+
+	atomic_init(&s->head, 0);
+	atomic_init(&s->tail, 0);
+	atomic_init(&s->sequence, 0);
+	atomic_init(&s->stop, 0);
+}
+
+/*
+ * Called from the real time thread every loop, never blocks.  When the analyser falls behind far
+ * enough to fill the ring the sample is dropped.
+ */
+void spectrum_push(struct spectrum* s, struct vec3 w) {
+	unsigned int head, tail;
+
+	s->decimation_sum.x += w.x;
+	s->decimation_sum.y += w.y;
+	s->decimation_sum.z += w.z;
+	if(++s->decimation_count < s->decimation) {
+		return;
+	}
+
+	head = atomic_load_explicit(&s->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&s->tail, memory_order_acquire);
+
+	if(head - tail >= SPECTRUM_RING_SIZE) {
+		s->dropped++;
+	} else {
+		s->ring[head & (SPECTRUM_RING_SIZE - 1)].x = s->decimation_sum.x / s->decimation;
+		s->ring[head & (SPECTRUM_RING_SIZE - 1)].y = s->decimation_sum.y / s->decimation;
+		s->ring[head & (SPECTRUM_RING_SIZE - 1)].z = s->decimation_sum.z / s->decimation;
+		atomic_store_explicit(&s->head, head + 1, memory_order_release);
+	}
+
+	memset(&s->decimation_sum, 0, sizeof(s->decimation_sum));
+	s->decimation_count = 0;
+}
+
+/*
+ * Copy the latest result out.  Returns 0 without touching out if the analyser is writing it right
+ * now, the caller then just keeps what it had.
+ */
+int spectrum_fetch(struct spectrum* s, struct spectrum_result* out) {
+	unsigned int before, after;
+
+	before = atomic_load_explicit(&s->sequence, memory_order_acquire);
+	if(before & 1) {
+		return 0;
+	}
+
+	memcpy(out, &s->result, sizeof(*out));
+
+	atomic_thread_fence(memory_order_acquire);
+	after = atomic_load_explicit(&s->sequence, memory_order_relaxed);
+
+	return before == after;
+}
+
+/*
+ * In place iterative radix 2 FFT of SPECTRUM_FFT_SIZE complex samples
+ */
+static void fft(const struct spectrum* s, double* re, double* im) {
+	double wr, wi, tr, ti, ur, ui, tmp;
+	int i, j, k, len, half, step;
+	int n = SPECTRUM_FFT_SIZE;
+
+	/* Bit reversed order */
+	for(i = 1, j = 0; i < n; i++) {
+		k = n >> 1;
+		while(j & k) {
+			j ^= k;
+			k >>= 1;
+		}
+		j |= k;
+
+		if(i < j) {
+			tmp = re[i]; re[i] = re[j]; re[j] = tmp;
+			tmp = im[i]; im[i] = im[j]; im[j] = tmp;
+		}
+	}
+
+	for(len = 2; len <= n; len <<= 1) {
+		half = len >> 1;
+		step = n / len;
+		for(i = 0; i < n; i += len) {
+			for(k = 0; k < half; k++) {
+				wr = s->twiddle_re[k * step];
+				wi = s->twiddle_im[k * step];
+				ur = re[i + k];
+				ui = im[i + k];
+				tr = re[i + k + half] * wr - im[i + k + half] * wi;
+				ti = re[i + k + half] * wi + im[i + k + half] * wr;
+				re[i + k] = ur + tr;
+				im[i + k] = ui + ti;
+				re[i + k + half] = ur - tr;
+				im[i + k + half] = ui - ti;
+			}
+		}
+	}
+}
+
+/*
+ * Find the strongest peaks in the summed spectrum of the last SPECTRUM_FFT_SIZE samples and
+ * publish a notch on each of them
+ */
+static void spectrum_analyse(struct spectrum* s, double cpu_load) {
+	double re[SPECTRUM_FFT_SIZE], im[SPECTRUM_FFT_SIZE];
+	double power[SPECTRUM_FFT_SIZE / 2];
+	double found[SPECTRUM_NOTCHES];
+	double mean, a, b, c, delta, f;
+	struct spectrum_result r;
+	struct biquad_filter notch;
+	unsigned int sequence;
+	int axis, i, j, k, kmin, kmax, peaks, best;
+
+	memset(power, 0, sizeof(power));
+
+	for(axis = 0; axis < FILTER_AXES; axis++) {
+		mean = 0.0;
+		for(i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+			mean += s->history[axis][i];
+		}
+		mean /= SPECTRUM_FFT_SIZE;
+
+		/* Oldest sample first, without the DC part so it doesn't leak through the window */
+		for(i = 0; i < SPECTRUM_FFT_SIZE; i++) {
+			re[i] = (s->history[axis][(s->history_pos + i) % SPECTRUM_FFT_SIZE] - mean) * s->window[i];
+			im[i] = 0.0;
+		}
+
+		fft(s, re, im);
+
+		for(k = 0; k < SPECTRUM_FFT_SIZE / 2; k++) {
+			power[k] += re[k] * re[k] + im[k] * im[k];
+		}
+	}
+
+	kmin = (int)ceil(SPECTRUM_MIN_HZ * SPECTRUM_FFT_SIZE / s->rate);
+	kmax = (int)(0.45 * SPECTRUM_FFT_SIZE);
+	if(kmin < 1) {
+		kmin = 1;
+	}
+
+	mean = 0.0;
+	for(k = kmin; k <= kmax; k++) {
+		mean += power[k];
+	}
+	mean /= kmax - kmin + 1;
+
+	/* Strongest local maxima well above the average, each one taken out before looking for the next */
+	peaks = 0;
+	while(peaks < SPECTRUM_NOTCHES) {
+		best = -1;
+		for(k = kmin; k <= kmax; k++) {
+			if(power[k] > power[k - 1] && power[k] >= power[k + 1] && power[k] > SPECTRUM_PEAK_RATIO * mean) {
+				if(best < 0 || power[k] > power[best]) {
+					best = k;
+				}
+			}
+		}
+		if(best < 0) {
+			break;
+		}
+
+		/* Parabolic interpolation between the bins around the peak */
+		a = sqrt(power[best - 1]);
+		b = sqrt(power[best]);
+		c = sqrt(power[best + 1]);
+		delta = 0.5 * (a - c) / (a - 2.0 * b + c);
+		found[peaks++] = (best + delta) * s->rate / SPECTRUM_FFT_SIZE;
+
+		for(k = best - 2; k <= best + 2; k++) {
+			if(k >= kmin && k <= kmax) {
+				power[k] = 0.0;
+			}
+		}
+	}
+
+	/* Lowest peak in the first slot so every notch keeps following the same peak */
+	for(i = 1; i < peaks; i++) {
+		for(j = i; j > 0 && found[j - 1] > found[j]; j--) {
+			f = found[j];
+			found[j] = found[j - 1];
+			found[j - 1] = f;
+		}
+	}
+
+	r = s->result;
+	for(i = 0; i < SPECTRUM_NOTCHES; i++) {
+		if(i >= peaks) {
+			r.frequency[i] = 0.0;
+			passthrough(&r.notch[i]);
+			continue;
+		}
+
+		if(r.frequency[i] > 0.0) {
+			r.frequency[i] += SPECTRUM_SMOOTHING * (found[i] - r.frequency[i]);
+		} else {
+			r.frequency[i] = found[i];
+		}
+
+		biquad_set_notch(&notch, r.frequency[i], s->rate * s->decimation, NOTCH_Q);
+		r.notch[i] = notch.c;
+	}
+	r.cpu_load = cpu_load;
+
+	/* Odd sequence while the result is inconsistent */
+	sequence = atomic_load_explicit(&s->sequence, memory_order_relaxed);
+	atomic_store_explicit(&s->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	s->result = r;
+	atomic_store_explicit(&s->sequence, sequence + 2, memory_order_release);
+}
+
+static double cpu_seconds(clockid_t clock) {
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/*
+ * Analyser thread, drains the ring and runs an analysis every SPECTRUM_HOP samples
+ */
+static void* spectrum_thread(void* args) {
+	struct spectrum* s = (struct spectrum*)args;
+	unsigned int head, tail;
+	double cpu_start, wall_start, cpu_load;
+	struct vec3 w;
+
+	/* Stay out of the way of everything else, this only has to keep up on average */
+	setpriority(PRIO_PROCESS, syscall(SYS_gettid), SPECTRUM_NICE);
+
+	cpu_start = cpu_seconds(CLOCK_THREAD_CPUTIME_ID);
+	wall_start = cpu_seconds(CLOCK_MONOTONIC);
+	cpu_load = 0.0;
+
+	while(!atomic_load(&s->stop)) {
+		tail = atomic_load_explicit(&s->tail, memory_order_relaxed);
+		head = atomic_load_explicit(&s->head, memory_order_acquire);
+
+		if(head == tail) {
+			usleep(SPECTRUM_POLL_US);
+			continue;
+		}
+
+		while(tail != head) {
+			w = s->ring[tail & (SPECTRUM_RING_SIZE - 1)];
+			tail++;
+
+			s->history[0][s->history_pos] = w.x;
+			s->history[1][s->history_pos] = w.y;
+			s->history[2][s->history_pos] = w.z;
+			s->history_pos = (s->history_pos + 1) % SPECTRUM_FFT_SIZE;
+
+			if(++s->fresh >= SPECTRUM_HOP) {
+				s->fresh = 0;
+				spectrum_analyse(s, cpu_load);
+			}
+		}
+
+		atomic_store_explicit(&s->tail, tail, memory_order_release);
+
+		/* Share of one core used since the last second */
+		if(cpu_seconds(CLOCK_MONOTONIC) - wall_start > 1.0) {
+			cpu_load = (cpu_seconds(CLOCK_THREAD_CPUTIME_ID) - cpu_start) / (cpu_seconds(CLOCK_MONOTONIC) - wall_start);
+			cpu_start = cpu_seconds(CLOCK_THREAD_CPUTIME_ID);
+			wall_start = cpu_seconds(CLOCK_MONOTONIC);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Start the analyser on a normal (not real time) thread
+ */
+void spectrum_start(struct spectrum* s) {
+	if(pthread_create(&s->thread, NULL, spectrum_thread, s) != 0) {
+		printf("Creating the spectrum analyser thread failed\r\n");
+		exit(1);
+	}
+}
+
+/*
+ * Ask the analyser to finish and wait for it
+ */
+void spectrum_stop(struct spectrum* s) {
+	atomic_store(&s->stop, 1);
+	pthread_join(s->thread, NULL);
+}
@@ -0,0 +1,77 @@
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "gyro.h"
+#include "filter.h"
+
+/*
+ * Gyroscope spectrum analyser with dynamic notch filters.
+ *
+ * Motor vibration shows up in the gyroscope as narrow peaks that move with the throttle.  The real
+ * time thread pushes (decimated) gyroscope samples into a single producer single consumer ring and
+ * carries on, a low priority thread drains it, runs a Hann windowed FFT over the last
+ * SPECTRUM_FFT_SIZE samples of every axis, finds the strongest peaks in the summed spectrum and
+ * hands notch coefficients back.  The handoff is a sequence counter around the coefficients: the
+ * real time thread never waits, if it catches the analyser in the middle of a write it keeps the
+ * coefficients it already has and tries again on the next loop.
+ */
+
+#ifndef _SPECTRUM_H
+#define _SPECTRUM_H
+
+#define SPECTRUM_FFT_SIZE 256    /* Samples per analysis, a power of 2 */
+#define SPECTRUM_RING_SIZE 1024  /* Samples buffered between the threads, a power of 2 */
+#define SPECTRUM_NOTCHES 2       /* Peaks tracked, one notch each */
+
+static const int SPECTRUM_HOP = SPECTRUM_FFT_SIZE / 2; /* New samples between analyses */
+static const double SPECTRUM_MIN_HZ = 80.0;   /* Lowest frequency a notch is put on, below is flight control */
+static const double SPECTRUM_PEAK_RATIO = 4.0; /* A peak must be this far above the band average */
+static const double SPECTRUM_SMOOTHING = 0.3;  /* Weight of a new peak frequency */
+static const int SPECTRUM_POLL_US = 2000;      /* Sleep of the analyser when the ring is empty */
+static const int SPECTRUM_NICE = 10;           /* Niceness of the analyser thread */
+
+/*
+ * Everything the analyser publishes, copied out as a whole
+ */
+struct spectrum_result {
+	struct biquad_coeffs notch[SPECTRUM_NOTCHES]; /* Pass through when no peak was found */
+	double frequency[SPECTRUM_NOTCHES];           /* Centre of every notch in Hz, 0 when off */
+	double cpu_load;                              /* Share of one core used by the analyser */
+};
+
+struct spectrum {
+	double rate;        /* Sample rate of the pushed samples in Hz */
+	int decimation;     /* Loop samples averaged into one pushed sample */
+
+	/* Producer side, only touched by the real time thread */
+	struct vec3 decimation_sum;
+	int decimation_count;
+	unsigned long dropped;
+
+	/* Ring of samples, the real time thread owns head and the analyser owns tail */
+	struct vec3 ring[SPECTRUM_RING_SIZE];
+	atomic_uint head;
+	atomic_uint tail;
+
+	/* Published result, odd sequence while it is being written */
+	atomic_uint sequence;
+	struct spectrum_result result;
+
+	/* Analyser side */
+	double window[SPECTRUM_FFT_SIZE];
+	double twiddle_re[SPECTRUM_FFT_SIZE / 2];
+	double twiddle_im[SPECTRUM_FFT_SIZE / 2];
+	double history[FILTER_AXES][SPECTRUM_FFT_SIZE];
+	int history_pos;
+	int fresh;          /* Samples since the last analysis */
+	atomic_int stop;
+	pthread_t thread;
+};
+
+void spectrum_init(struct spectrum*, double, int);
+void spectrum_start(struct spectrum*);
+void spectrum_stop(struct spectrum*);
+void spectrum_push(struct spectrum*, struct vec3);
+int spectrum_fetch(struct spectrum*, struct spectrum_result*);
+
+#endif
@@ -0,0 +1,78 @@
+#include <string.h>
+#include <time.h>
+
+#include "spsc.h"
+
+/*
+ * Use the memory at slots for capacity messages of size bytes, capacity has to be a power of 2
+ */
+void spsc_init(struct spsc_ring* r, void* slots, size_t size, unsigned int capacity) {
+	r->slots = slots;
+	r->size = size;
+	r->mask = capacity - 1;
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	r->dropped = 0;
+}
+
+/*
+ * Copy a message into the ring, returns 0 (and counts a drop) if it is full
+ */
+int spsc_push(struct spsc_ring* r, const void* msg) {
+	unsigned int head, tail;
+
+	head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+	if(head - tail > r->mask) {
+		r->dropped++;
+		return 0;
+	}
+
+	memcpy(r->slots + (head & r->mask) * r->size, msg, r->size);
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+
+	return 1;
+}
+
+/*
+ * Copy the oldest message out of the ring, returns 0 if it is empty
+ */
+int spsc_pop(struct spsc_ring* r, void* msg) {
+	unsigned int head, tail;
+
+	tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+	if(head == tail) {
+		return 0;
+	}
+
+	memcpy(msg, r->slots + (tail & r->mask) * r->size, r->size);
+	atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+
+	return 1;
+}
+
+/*
+ * Wait for the next message, spinning first (the consumer has its own core) and then sleeping
+ * between polls.  Returns 0 without a message once stop is set.
+ */
+int spsc_pop_wait(struct spsc_ring* r, void* msg, atomic_int* stop) {
+	struct timespec ts;
+	int spins;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = SPSC_SLEEP_NS;
+
+	for(spins = 0; !spsc_pop(r, msg); spins++) {
+		if(atomic_load_explicit(stop, memory_order_relaxed)) {
+			return 0;
+		}
+		if(spins >= SPSC_SPIN) {
+			clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+		}
+	}
+
+	return 1;
+}
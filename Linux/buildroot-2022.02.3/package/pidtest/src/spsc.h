@@ -0,0 +1,33 @@
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+ * Single producer single consumer ring of fixed size messages between two real time threads.
+ *
+ * The producer only writes head and the consumer only writes tail, so pushing and popping are a
+ * copy and one atomic store each and neither side ever waits for the other.  A push into a full
+ * ring fails and is counted instead of overwriting a message the consumer may be reading.  The
+ * messages live in memory given by the caller, capacity (a power of 2) times the message size.
+ */
+
+#ifndef _SPSC_H
+#define _SPSC_H
+
+static const int SPSC_SPIN = 1000;       /* Polls of an empty ring before the consumer starts sleeping */
+static const long SPSC_SLEEP_NS = 20000; /* Sleep between polls after that */
+
+struct spsc_ring {
+	unsigned char* slots;
+	size_t size;
+	unsigned int mask;
+	atomic_uint head;
+	atomic_uint tail;
+	unsigned long dropped; /* Only written by the producer */
+};
+
+void spsc_init(struct spsc_ring*, void*, size_t, unsigned int);
+int spsc_push(struct spsc_ring*, const void*);
+int spsc_pop(struct spsc_ring*, void*);
+int spsc_pop_wait(struct spsc_ring*, void*, atomic_int*);
+
+#endif
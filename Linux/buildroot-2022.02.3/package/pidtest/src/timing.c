@@ -0,0 +1,14 @@
+#include <time.h>
+
+#include "timing.h"
+
+/*
+ * Seconds on CLOCK_MONOTONIC
+ */
+double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
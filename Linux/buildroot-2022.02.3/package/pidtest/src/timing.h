@@ -0,0 +1,10 @@
+/*
+ * Wall clock for the benchmarks and the offline replay tools
+ */
+
+#ifndef _TIMING_H
+#define _TIMING_H
+
+double now(void);
+
+#endif
@@ -0,0 +1,49 @@
+#include <string.h>
+
+#include "triplebuf.h"
+
+/*
+ * Use the memory at copies (3 * size bytes) for the three copies, all of them start zeroed
+ */
+void triple_buffer_init(struct triple_buffer* tb, void* copies, size_t size) {
+	tb->copies = copies;
+	tb->size = size;
+	tb->back = 0;
+	atomic_init(&tb->middle, 1);
+	tb->front = 2;
+	tb->published = 0;
+
+	memset(copies, 0, 3 * size);
+}
+
+/*
+ * Copy for the writer to fill in, it holds an old state so every field has to be written
+ */
+void* triple_buffer_back(struct triple_buffer* tb) {
+	return tb->copies + tb->back * tb->size;
+}
+
+/*
+ * Hand the back copy over as the latest state
+ */
+void triple_buffer_publish(struct triple_buffer* tb) {
+	tb->back = atomic_exchange_explicit(&tb->middle, tb->back | TRIPLEBUF_FRESH, memory_order_acq_rel) & ~TRIPLEBUF_FRESH;
+	tb->published++;
+}
+
+/*
+ * Point state at the latest published copy, returns 1 if it is newer than the one from the last
+ * call.  The copy stays valid until the next call.
+ */
+int triple_buffer_read(struct triple_buffer* tb, void** state) {
+	int fresh = 0;
+
+	if(atomic_load_explicit(&tb->middle, memory_order_relaxed) & TRIPLEBUF_FRESH) {
+		tb->front = atomic_exchange_explicit(&tb->middle, tb->front, memory_order_acq_rel) & ~TRIPLEBUF_FRESH;
+		fresh = 1;
+	}
+
+	*state = tb->copies + tb->front * tb->size;
+
+	return fresh;
+}
@@ -0,0 +1,33 @@
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+ * Wait-free handoff of the latest state from one writer thread to one reader thread.
+ *
+ * Three copies of the state exist: the writer fills its back copy and swaps it with the shared
+ * middle one in a single atomic exchange, the reader swaps its front copy with the middle one when
+ * there is something new in it.  Neither side ever waits for the other or retries, the writer never
+ * loses an update to contention (the reader simply sees the latest one) and the reader always has a
+ * complete copy.  The copies live in memory given by the caller, three times the size of the state.
+ */
+
+#ifndef _TRIPLEBUF_H
+#define _TRIPLEBUF_H
+
+static const int TRIPLEBUF_FRESH = 4; /* Set in the shared index when the middle copy hasn't been read */
+
+struct triple_buffer {
+	unsigned char* copies;
+	size_t size;
+	atomic_int middle;  /* Index of the shared copy and TRIPLEBUF_FRESH */
+	int back;           /* Only touched by the writer */
+	int front;          /* Only touched by the reader */
+	unsigned long published;
+};
+
+void triple_buffer_init(struct triple_buffer*, void*, size_t);
+void* triple_buffer_back(struct triple_buffer*);
+void triple_buffer_publish(struct triple_buffer*);
+int triple_buffer_read(struct triple_buffer*, void**);
+
+#endif
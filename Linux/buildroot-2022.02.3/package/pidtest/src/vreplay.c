@@ -0,0 +1,357 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gyro.h"
+#include "quaternion.h"
+#include "madgwick.h"
+#include "replaylog.h"
+#include "timing.h"
+#include "simd.h"
+#include "madgwick_simd.h"
+
+/*
+ * Offline replay engine for tuning the Madgwick gain over many recorded runs at once.
+ *
+ * Every (log, beta) pair is an independent filter instance and the instances are packed into the
+ * lanes of madgwick_simd.c, so one pass over the data advances SIMD_LANES filters.  The groups of
+ * lanes are split over -j threads.  Each lane is scored against the true attitude in its log and
+ * the throughput is reported in samples per second per core, next to the scalar madgwick.c.
+ *
+ * Usage: vreplay [-B beta,beta,...] [-n simulated logs] [-r rate] [-s seconds] [-j threads] [log.csv ...]
+ */
+
+#define MAX_BETAS 32
+
+static const double DEFAULT_RATE = 500.0;    /* Simulated loop rate in Hz */
+static const double DEFAULT_SECONDS = 60.0;  /* Length of each simulated run */
+static const double SETTLE_TIME = 5.0;       /* Time to let the filters converge before scoring */
+static const double MIN_BENCH_TIME = 0.5;    /* Time to spend on each timing pass */
+
+struct log {
+	const char* name;
+	struct sample* samples;
+	int count;
+	int has_truth;
+};
+
+/*
+ * SIMD_LANES filter instances and their inputs, one lane_sample per step
+ */
+struct group {
+	int lanes;                 /* Lanes in use, the rest replay a copy of lane 0 */
+	int log[SIMD_LANES];
+	float beta[SIMD_LANES];
+	struct lane_sample* steps;
+	int steps_count;
+};
+
+struct worker {
+	pthread_t thread;
+	struct group* groups;
+	int first;
+	int last;
+};
+
+/*
+ * Pack the samples of every lane into vectors.  Shorter logs repeat their last sample with a zero
+ * time step, which leaves the attitude alone.
+ */
+static void pack_group(struct group* g, const struct log* logs) {
+	struct lane_sample* in;
+	const struct log* l;
+	int i, lane, src, idx;
+
+	g->steps_count = 0;
+	for(lane = 0; lane < g->lanes; lane++) {
+		if(logs[g->log[lane]].count - 1 > g->steps_count) {
+			g->steps_count = logs[g->log[lane]].count - 1;
+		}
+	}
+
+	/* malloc() only guarantees 16 byte alignment, the AVX vectors need 32 */
+	if(posix_memalign((void**)&g->steps, __alignof__(struct lane_sample), g->steps_count * sizeof(struct lane_sample)) != 0) {
+		printf("Failed to allocate the packed samples\r\n");
+		exit(1);
+	}
+
+	for(i = 0; i < g->steps_count; i++) {
+		in = &g->steps[i];
+		for(lane = 0; lane < SIMD_LANES; lane++) {
+			src = lane < g->lanes ? lane : 0;
+			l = &logs[g->log[src]];
+			idx = i + 1 < l->count ? i + 1 : l->count - 1;
+
+			in->dt[lane] = i + 1 < l->count ? l->samples[idx].t - l->samples[idx - 1].t : 0.0f;
+			in->wx[lane] = l->samples[idx].w.x;
+			in->wy[lane] = l->samples[idx].w.y;
+			in->wz[lane] = l->samples[idx].w.z;
+			in->ax[lane] = l->samples[idx].a.x;
+			in->ay[lane] = l->samples[idx].a.y;
+			in->az[lane] = l->samples[idx].a.z;
+			in->mx[lane] = l->samples[idx].m.x;
+			in->my[lane] = l->samples[idx].m.y;
+			in->mz[lane] = l->samples[idx].m.z;
+		}
+	}
+}
+
+static void init_lanes(struct madgwick_lanes* f, const struct group* g) {
+	vfloat beta;
+	int lane;
+
+	for(lane = 0; lane < SIMD_LANES; lane++) {
+		beta[lane] = g->beta[lane < g->lanes ? lane : 0];
+	}
+
+	madgwick_lanes_init(f, beta);
+}
+
+/*
+ * Timing pass over a range of groups, nothing is scored so only the filter is measured
+ */
+static void* run_groups(void* args) {
+	struct worker* w = (struct worker*)args;
+	struct madgwick_lanes f;
+	struct group* g;
+	int i, j;
+
+	for(i = w->first; i < w->last; i++) {
+		g = &w->groups[i];
+		init_lanes(&f, g);
+		for(j = 0; j < g->steps_count; j++) {
+			madgwick_lanes_update(&f, &g->steps[j]);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Parse a comma separated list of gains
+ */
+static int parse_betas(char* list, float* betas) {
+	char* tok;
+	int n;
+
+	n = 0;
+	for(tok = strtok(list, ","); tok != NULL && n < MAX_BETAS; tok = strtok(NULL, ",")) {
+		betas[n++] = atof(tok);
+	}
+
+	return n;
+}
+
+int main(int argc, char** argv) {
+	struct log* logs;
+	struct group* groups;
+	struct worker* workers;
+	struct madgwick_lanes f;
+	struct madgwick_filter scalar;
+	struct quaternion q;
+	struct log* l;
+	struct group* g;
+	float betas[MAX_BETAS];
+	double rate, seconds, start, elapsed, total, error;
+	double sum[SIMD_LANES], max[SIMD_LANES];
+	int scored[SIMD_LANES];
+	int i, j, k, lane, opt, nlogs, nbetas, simulated, threads, lanes, ngroups, passes;
+
+	rate = DEFAULT_RATE;
+	seconds = DEFAULT_SECONDS;
+	simulated = 8;
+	threads = 1;
+	betas[0] = BETA;
+	nbetas = 1;
+
+	while((opt = getopt(argc, argv, "B:n:r:s:j:")) != -1) {
+		switch(opt) {
+		case 'B': /* Gains to try on every log */
+			nbetas = parse_betas(optarg, betas);
+			break;
+		case 'n': /* Number of simulated logs when no log files are given */
+			simulated = atoi(optarg);
+			break;
+		case 'r': /* Simulated loop rate in Hz */
+			rate = atof(optarg);
+			break;
+		case 's': /* Simulated run length in seconds */
+			seconds = atof(optarg);
+			break;
+		case 'j': /* Worker threads, one per core */
+			threads = atoi(optarg);
+			break;
+		default:
+			printf("Usage: %s [-B beta,beta,...] [-n simulated logs] [-r rate] [-s seconds] [-j threads] [log.csv ...]\r\n", argv[0]);
+			exit(1);
+		}
+	}
+
+	if(nbetas < 1 || simulated < 1 || threads < 1) {
+		printf("Need at least one gain, log and thread\r\n");
+		exit(1);
+	}
+
+	/* Load or simulate the logs */
+	nlogs = optind < argc ? argc - optind : simulated;
+	logs = malloc(nlogs * sizeof(struct log));
+	if(logs == NULL) {
+		printf("Failed to allocate the logs\r\n");
+		exit(1);
+	}
+
+	for(i = 0; i < nlogs; i++) {
+		l = &logs[i];
+		if(optind < argc) {
+			l->name = argv[optind + i];
+			l->samples = load_log(l->name, &l->count, &l->has_truth);
+			if(l->samples == NULL) {
+				printf("Failed to open the log %s\r\n", l->name);
+				exit(1);
+			}
+		} else {
+			l->name = "simulated";
+			l->samples = simulate(rate, seconds, i + 1, &l->count);
+			l->has_truth = 1;
+		}
+
+		if(l->count < 2) {
+			printf("Not enough samples in log %d\r\n", i);
+			exit(1);
+		}
+	}
+
+	/* Every (log, beta) pair gets a lane */
+	lanes = nlogs * nbetas;
+	ngroups = (lanes + SIMD_LANES - 1) / SIMD_LANES;
+	groups = calloc(ngroups, sizeof(struct group));
+	if(groups == NULL) {
+		printf("Failed to allocate the lane groups\r\n");
+		exit(1);
+	}
+
+	for(i = 0; i < lanes; i++) {
+		g = &groups[i / SIMD_LANES];
+		g->log[g->lanes] = i / nbetas;
+		g->beta[g->lanes] = betas[i % nbetas];
+		g->lanes++;
+	}
+
+	total = 0.0;
+	for(i = 0; i < ngroups; i++) {
+		pack_group(&groups[i], logs);
+		for(lane = 0; lane < groups[i].lanes; lane++) {
+			total += logs[groups[i].log[lane]].count - 1;
+		}
+	}
+
+	printf("Replaying %d logs with %d gains in %d %s lanes of %d\r\n", nlogs, nbetas, lanes, SIMD_NAME, SIMD_LANES);
+
+	/* Accuracy pass, one group at a time */
+	printf("%-6s %-24s %10s %12s %12s\r\n", "lane", "log", "beta", "rms (deg)", "max (deg)");
+
+	for(i = 0; i < ngroups; i++) {
+		g = &groups[i];
+		init_lanes(&f, g);
+		memset(sum, 0, sizeof(sum));
+		memset(max, 0, sizeof(max));
+		memset(scored, 0, sizeof(scored));
+
+		for(j = 0; j < g->steps_count; j++) {
+			madgwick_lanes_update(&f, &g->steps[j]);
+
+			for(lane = 0; lane < g->lanes; lane++) {
+				l = &logs[g->log[lane]];
+				if(!l->has_truth || j + 1 >= l->count || l->samples[j + 1].t - l->samples[0].t < SETTLE_TIME) {
+					continue;
+				}
+
+				q.q1 = f.q1[lane];
+				q.q2 = f.q2[lane];
+				q.q3 = f.q3[lane];
+				q.q4 = f.q4[lane];
+				error = attitude_distance(q, l->samples[j + 1].truth);
+				sum[lane] += error * error;
+				scored[lane]++;
+				if(error > max[lane]) {
+					max[lane] = error;
+				}
+			}
+		}
+
+		for(lane = 0; lane < g->lanes; lane++) {
+			if(scored[lane] > 0) {
+				printf("%-6d %-24s %10.4f %12.3f %12.3f\r\n", i * SIMD_LANES + lane, logs[g->log[lane]].name,
+					g->beta[lane], sqrt(sum[lane] / scored[lane]), max[lane]);
+			} else {
+				printf("%-6d %-24s %10.4f %12s %12s\r\n", i * SIMD_LANES + lane, logs[g->log[lane]].name,
+					g->beta[lane], "-", "-");
+			}
+		}
+	}
+
+	/* Scalar reference on one core */
+	passes = 0;
+	start = now();
+	do {
+		for(i = 0; i < lanes; i++) {
+			l = &logs[i / nbetas];
+			madgwick_init(&scalar);
+			scalar.beta = betas[i % nbetas];
+			for(k = 1; k < l->count; k++) {
+				madgwick_update(&scalar, l->samples[k].w, l->samples[k].a, l->samples[k].m, l->samples[k].t - l->samples[k - 1].t);
+			}
+		}
+		passes++;
+		elapsed = now() - start;
+	} while(elapsed < MIN_BENCH_TIME);
+
+	printf("Scalar: %.0f samples per second on one core\r\n", total * passes / elapsed);
+
+	/* SIMD timing pass split over the worker threads */
+	if(threads > ngroups) {
+		threads = ngroups;
+	}
+
+	workers = malloc(threads * sizeof(struct worker));
+	if(workers == NULL) {
+		printf("Failed to allocate the workers\r\n");
+		exit(1);
+	}
+
+	passes = 0;
+	start = now();
+	do {
+		for(i = 0; i < threads; i++) {
+			workers[i].groups = groups;
+			workers[i].first = ngroups * i / threads;
+			workers[i].last = ngroups * (i + 1) / threads;
+			if(pthread_create(&workers[i].thread, NULL, run_groups, &workers[i]) != 0) {
+				printf("Creating a worker thread failed\r\n");
+				exit(1);
+			}
+		}
+		for(i = 0; i < threads; i++) {
+			pthread_join(workers[i].thread, NULL);
+		}
+		passes++;
+		elapsed = now() - start;
+	} while(elapsed < MIN_BENCH_TIME);
+
+	printf("%s: %.0f samples per second per core on %d cores\r\n", SIMD_NAME, total * passes / elapsed / threads, threads);
+
+	for(i = 0; i < ngroups; i++) {
+		free(groups[i].steps);
+	}
+	for(i = 0; i < nlogs; i++) {
+		free(logs[i].samples);
+	}
+	free(workers);
+	free(groups);
+	free(logs);
+
+	return 0;
+}
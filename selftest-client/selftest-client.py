@@ -61,6 +61,15 @@ def main():
     z = 0
     throttle = 0
     elapsed = 0
+    latency = 0
+    notch = [0, 0]
+    analyser_cpu = 0
+    setpoint = [0, 0, 0]
+    output_latency = [0, 0, 0]
+    pipeline_latency = [0, 0, 0]
+    jitter = [0, 0, 0]
+    misses = 0
+    step = {}
 
     s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
     
@@ -91,7 +100,7 @@ def main():
 
 
         try:
-            bytestr = s.recv(128)
+            bytestr = s.recv(1024)
             string = bytestr.decode("UTF-8")
             data = json.loads(string)
             print(data)
@@ -102,6 +111,15 @@ def main():
                 z = data['z']
                 throttle = data['throttle']
                 elapsed = data['elapsed']
+                latency = data.get('latency', 0)
+                notch = data.get('notch', [0, 0])
+                analyser_cpu = data.get('analyser_cpu', 0)
+                setpoint = data.get('setpoint', [0, 0, 0])
+                output_latency = data.get('modelled_output_latency', [0, 0, 0])
+                pipeline_latency = data.get('pipeline_latency', [0, 0, 0])
+                jitter = data.get('jitter', [0, 0, 0])
+                misses = data.get('deadline_misses', 0)
+                step = data.get('step', {})
 
         except Exception as e:
             print(f"There was an issue:\n{e}")
@@ -118,6 +136,14 @@ def main():
         drawText(-2, 1.5, f"It took {elapsed} seconds to poll the sensor")
         drawText(-2, 1.25, f"The throttle is set to {throttle} us pulses ")
         drawText(-2, 1.0, f"The angle was [{x}, {y}, {z}]")
+        drawText(-2, 0.75, f"The controller predicts the attitude {latency * 1000:.1f} ms ahead")
+        drawText(-2, 0.5, f"Gyro notches at {notch[0]:.0f} and {notch[1]:.0f} Hz, analyser at {analyser_cpu * 100:.1f}% CPU")
+        drawText(-2, -0.5, f"Loop jitter {jitter[0]:.0f} us median, {jitter[1]:.0f} us p99, {jitter[2]:.0f} us max, {misses} deadline misses")
+        drawText(-2, -0.25, f"Modelled output latency {output_latency[0]:.2f} ms median, {output_latency[1]:.2f} ms p99, {output_latency[2]:.2f} ms max")
+        drawText(-2, -0.75, f"Sample to control {pipeline_latency[0]:.0f} us median, {pipeline_latency[1]:.0f} us p99, {pipeline_latency[2]:.0f} us max")
+        drawText(-2, 0.25, f"The setpoint is [{setpoint[0]}, {setpoint[1]}, {setpoint[2]}]")
+        if step.get('index', 0) > 0:
+            drawText(-2, 0.0, f"Step {step['index']}: rise {step['rise']:.3f} s, overshoot {step['overshoot']:.1f}%, settling {step['settling']:.3f} s, error {step['error']:.2f} deg")
 
         pygame.display.flip()
 